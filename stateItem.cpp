@@ -32,6 +32,7 @@
 #include "T3D/projectile.h"
 #include "T3D/gameBase/gameConnection.h"
 #include "T3D/debris.h"
+#include "T3D/missionArea.h"
 #include "math/mathUtils.h"
 #include "sim/netObject.h"
 #include "sfx/sfxTrack.h"
@@ -41,6 +42,15 @@
 #include "scene/sceneManager.h"
 #include "scene/sceneRenderState.h"
 #include "core/stream/fileStream.h"
+#include "platform/threads/thread.h"
+#include "platform/platformTimer.h"
+#include "T3D/stateItemManager.h"
+#include "T3D/stateItemVoicePool.h"
+#include "T3D/stateItemLights.h"
+#include "T3D/stateItemEmitterPool.h"
+#include "T3D/stateItemCasings.h"
+#include "T3D/stateItemDataCache.h"
+#include "T3D/stateItemRecorder.h"
 //-JR
 
 
@@ -52,8 +62,27 @@ const S32 sCollisionTimeout = 15;       // Timout value in ticks
 static F32 sMinWarpTicks = 0.5 ;        // Fraction of tick at which instant warp occures
 static S32 sMaxWarpTicks = 3;           // Max warp duration in ticks
 
+// Network tiers
+static F32 sNetNearDistance = 50.0f;    // Full rate updates within this
+static F32 sNetVisibleScale = 3.0f;     // In front of the camera, near goes out this much further
+static S32 sNetFarPositionInterval = 500; // Ms between position updates to far clients
+static const F32 sNetFarPositionPrecision = 0.05f;
+static const F32 sNetFarVelocityMin = 0.1f;
+static const F32 sNetFarVelocityMax = 200.0f;
+
 F32 StateItem::mGravity = -20.0f;
 
+#ifdef STATEITEM_PROFILE
+bool StateItem::smProfile = false;
+
+// Shared by all the callback timings, only differences are read.
+static PlatformTimer* getProfileTimer()
+{
+   static PlatformTimer* timer = PlatformTimer::create();
+   return timer;
+}
+#endif
+
 const U32 sClientCollisionMask = (TerrainObjectType     |
                                   InteriorObjectType    |  StaticShapeObjectType |
                                   VehicleObjectType     |  PlayerObjectType      | 
@@ -64,6 +93,10 @@ const U32 sServerCollisionMask = (sClientCollisionMask |
 
 const S32 StateItem::csmAtRestTimer = 64;
 
+const U32 StateItem::csmNetInputs = StateItemData::LoadedInput | StateItemData::TriggerInput |
+   StateItemData::AltTriggerInput | StateItemData::AmmoInput | StateItemData::TargetInput |
+   StateItemData::WetInput;
+
 static const U32 sgAllowedDynamicTypes = DynamicShapeObjectType;//DamagableStateItemObjectType; ?? -JR
 
 //-JR
@@ -221,6 +254,16 @@ StateItemData::StateItemData()
    
    simpleServerCollision = true;
 
+   continuousCollision = false;
+   ccdVelocityThreshold = 20.0f;
+   ccdMaxSubsteps = 4;
+
+   netPositionBits = 0;
+   netVelocityBits = 0;
+   netBounds.set(Point3F::Zero, Point3F::Zero);
+   mNetBounds.set(Point3F::Zero, Point3F::Zero);
+   mNetBoundsPending = false;
+
    //-JR
    //advanced StateItem support
    emap = false;
@@ -256,6 +299,10 @@ StateItemData::StateItemData()
 
    animateOnServer = false;
 
+   animCullOffscreen = true;
+   animLODDistance = 0.0f;
+   animLODInterval = 0.1f;
+
    scriptAnimTransitionTime = 0.25f;
 
    //
@@ -317,6 +364,13 @@ StateItemData::StateItemData()
       stateIgnoreLoadedForReady[i] = false;
    }
    statesLoaded = false;
+   mStateBlobHash = 0;
+   mStatesPending = false;
+   mCallbackSequence = 0;
+   mStateCallbacks = NULL;
+#ifdef STATEITEM_PROFILE
+   resetProfile();
+#endif
    
    maxConcurrentSounds = 0;
 
@@ -355,13 +409,18 @@ bool StateItemData::onAdd()
    if (!Parent::onAdd())
       return false;
 
+   // Names first, so transitions below can resolve through the name map.
+   if (statesLoaded == false)
+      for (U32 i = 0; i < MaxStates; i++)
+         state[i].name = stateName[i];
+   buildStateNameMap();
+
    // Copy state data from the scripting arrays into the
    // state structure array. If we have state data already,
    // we are on the client and need to leave it alone.
    for (U32 i = 0; i < MaxStates; i++) {
 	  StateData& s = state[i];
 	  if (statesLoaded == false) {
-		 s.name = stateName[i];
 		 s.transition.loaded[0] = lookupState(stateTransitionNotLoaded[i]);
 		 s.transition.loaded[1] = lookupState(stateTransitionLoaded[i]);
 		 s.transition.ammo[0] = lookupState(stateTransitionNoAmmo[i]);
@@ -431,11 +490,173 @@ bool StateItemData::onAdd()
 		 reloadState = i;
    }
 
+   compileTransitionTable();
+   compileReadyTable();
+   bindStateCallbacks();
+
+   // The client has what the server settled on.
+   if (statesLoaded == false)
+   {
+      ccdMaxSubsteps = mClamp(ccdMaxSubsteps, 1, 16);
+      fixNetQuantization();
+   }
+
    // Always preload images, this is needed to avoid problems with
    // resolving sequences before transmission to a client.
    return true;
 }
 
+//----------------------------------------------------------------------------
+
+typedef HashTable<StringTableEntry, StateItemData::StateCallbackFn> StateCallbackMap;
+
+struct StateItemData::StateCallbackTable
+{
+   struct Binding
+   {
+      StateCallbackFn native;
+      Namespace::Entry* entry;
+   };
+   Binding states[MaxStates];
+};
+
+StateItemData::~StateItemData()
+{
+   delete mStateCallbacks;
+}
+
+// Function local, handlers may be registered by static constructors.
+static StateCallbackMap& getNativeStateCallbacks()
+{
+   static StateCallbackMap sMap;
+   return sMap;
+}
+
+void StateItemData::registerStateCallback(const char* name, StateCallbackFn fn)
+{
+   getNativeStateCallbacks().insertUnique(StringTable->insert(name), fn);
+}
+
+void StateItemData::bindStateCallbacks()
+{
+   mCallbackSequence = Namespace::mCacheSequence;
+   if (!mStateCallbacks)
+      mStateCallbacks = new StateCallbackTable;
+
+   StateCallbackMap& natives = getNativeStateCallbacks();
+   Namespace* ns = getNamespace();
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      StateCallbackTable::Binding& cb = mStateCallbacks->states[i];
+      cb.native = NULL;
+      cb.entry = NULL;
+
+      const char* script = state[i].script;
+      if (!script || !script[0])
+         continue;
+
+      StringTableEntry name = StringTable->insert(script);
+      StateCallbackMap::Iterator itr = natives.find(name);
+      if (itr != natives.end())
+         cb.native = itr->value;
+      else if (ns)
+         cb.entry = ns->lookup(name);
+   }
+}
+
+void StateItemData::invokeStateCallback(U32 stateIdx, StateItem* obj)
+{
+   // Scripts were exec'd or packages changed, our entries may be stale.
+   if (!mStateCallbacks || mCallbackSequence != Namespace::mCacheSequence)
+      bindStateCallbacks();
+
+   const StateCallbackTable::Binding& cb = mStateCallbacks->states[stateIdx];
+   SceneObject* holder = obj->getObjectMount();
+   if (cb.native)
+   {
+      cb.native(this, obj, holder);
+      return;
+   }
+   if (!cb.entry)
+   {
+      Con::warnf("StateItemData::invokeStateCallback - %s has no method %s", getName(), state[stateIdx].script);
+      return;
+   }
+
+   // What Con::execute does for an object, minus the lookup.
+   //                      //datablock     //us                 //owner
+   const char* argv[4] = { cb.entry->mFunctionName, getIdString(), obj->getIdString(), holder ? holder->getIdString() : "0" };
+   SimObject* save = gEvalState.thisObject;
+   gEvalState.thisObject = this;
+   cb.entry->execute(4, argv, &gEvalState);
+   gEvalState.thisObject = save;
+}
+
+#ifdef STATEITEM_PROFILE
+void StateItemData::resetProfile()
+{
+   dMemset(profile, 0, sizeof(profile));
+   profileEdges.clear();
+   profileStart = Sim::getCurrentTime();
+}
+
+void StateItemData::profileTransition(S32 from, U32 to, SimTime timeInFrom)
+{
+   profile[to].entries++;
+   if (from < 0)
+      return;
+
+   profile[from].time += timeInFrom;
+
+   U32 key = (U32(from) << 16) | to;
+   HashTable<U32, U32>::Iterator itr = profileEdges.find(key);
+   if (itr != profileEdges.end())
+      itr->value++;
+   else
+      profileEdges.insertUnique(key, 1);
+}
+
+static S32 QSORT_CALLBACK compareProfileEdge(const void* a, const void* b)
+{
+   U32 ka = *(const U32*)a;
+   U32 kb = *(const U32*)b;
+   return (ka < kb) ? -1 : (ka > kb) ? 1 : 0;
+}
+
+void StateItemData::getProfileCSV(Vector<String>& lines)
+{
+   F32 seconds = getMax(F32(Sim::getCurrentTime() - profileStart) / 1000.0f, 0.001f);
+
+   lines.push_back("state,name,seconds,entries,callbacks,callback_ms,emitters,sounds,lights");
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      const StateProfile& p = profile[i];
+      if (!p.entries && !p.spawns[EmitterSpawn] && !p.spawns[SoundSpawn] && !p.spawns[LightSpawn])
+         continue;
+      lines.push_back(String::ToString("%d,%s,%.3f,%d,%d,%d,%d,%d,%d", i, state[i].name ? state[i].name : "",
+         F32(p.time) / 1000.0f, p.entries, p.callbacks, p.callbackMs,
+         p.spawns[EmitterSpawn], p.spawns[SoundSpawn], p.spawns[LightSpawn]));
+   }
+
+   // Edges in from, to order, so dumps can be diffed.
+   Vector<U32> keys;
+   for (HashTable<U32, U32>::Iterator itr = profileEdges.begin(); itr != profileEdges.end(); ++itr)
+      keys.push_back(itr->key);
+   dQsort(keys.address(), keys.size(), sizeof(U32), compareProfileEdge);
+
+   lines.push_back("");
+   lines.push_back("from,to,transitions,per_second");
+   for (U32 i = 0; i < keys.size(); i++)
+   {
+      U32 count = profileEdges.find(keys[i])->value;
+      const char* from = state[keys[i] >> 16].name;
+      const char* to = state[keys[i] & 0xFFFF].name;
+      lines.push_back(String::ToString("%s,%s,%d,%.3f", from ? from : "", to ? to : "",
+         count, F32(count) / seconds));
+   }
+}
+#endif
+
 bool StateItemData::preload(bool server, String &errorStr)
 {
    if (!Parent::preload(server, errorStr))
@@ -456,6 +677,11 @@ bool StateItemData::preload(bool server, String &errorStr)
 		 if( !sfxResolve( &state[ i ].sound, str ) )
 			Con::errorf( ConsoleLogEntry::General, str.c_str() );
 	   }
+
+      // Not in the cache, the server sends them and installStateBlob
+      // finishes the job.
+      if (mStatesPending)
+         StateItemDataCache::requestStates(this);
    }
 
    // Use the first person eye offset if it's set.
@@ -555,18 +781,134 @@ bool StateItemData::preload(bool server, String &errorStr)
    }
 
 
+   // Sequences are resolved now, the states won't change again.
+   if (server)
+      compileStateBlob();
+
    /*TSShapeInstance* pDummy = new TSShapeInstance(shape, !server);
    delete pDummy;*/
    return true;
 }
 
+void StateItemData::compileReadyTable()
+{
+   readyTable.setSize(MaxReadyDepth * MaxStates * ReadyWords);
+   dMemset(readyTable.address(), 0, readyTable.memSize());
+
+   // Deepest first, each depth only looks one further in.
+   for (S32 depth = MaxReadyDepth - 1; depth >= 0; depth--)
+   {
+      for (U32 i = 0; i < MaxStates; i++)
+      {
+         const StateData& s = state[i];
+         const StateData::Transition& t = s.transition;
+         U32* row = &readyTable[(depth * MaxStates + i) * ReadyWords];
+
+         for (U32 key = 0; key < ReadyKeyCount; key++)
+         {
+            bool ready = s.fire;
+
+            if (!ready && depth + 1 < MaxReadyDepth)
+            {
+               // The transitions the old recursive isReady followed.
+               U32 inputs = (key & (TriggerInput - 1)) | ((key >> 5) * GenericTriggerInput);
+               S32 next[5 + MaxGenericTriggers + 3];
+               U32 count = 0;
+               next[count++] = t.loaded[s.ignoreLoadedForReady || (inputs & LoadedInput)];
+               for (U32 j = 0; j < MaxGenericTriggers; j++)
+                  next[count++] = t.genericTrigger[j][(inputs & (GenericTriggerInput << j)) != 0];
+               next[count++] = t.ammo[(inputs & AmmoInput) != 0];
+               next[count++] = t.target[(inputs & TargetInput) != 0];
+               next[count++] = t.wet[(inputs & WetInput) != 0];
+               next[count++] = t.motion[(inputs & MotionInput) != 0];
+               next[count++] = t.trigger[1];
+               next[count++] = t.altTrigger[1];
+               next[count++] = t.timeout;
+
+               for (U32 j = 0; !ready && j < count; j++)
+                  ready = next[j] != -1 && lookupReady(next[j], depth + 1, inputs);
+            }
+
+            if (ready)
+               row[key / 32] |= 1 << (key % 32);
+         }
+      }
+   }
+}
+
+void StateItemData::compileTransitionTable()
+{
+   transitionTable.setSize(MaxStates * TransitionTableSize);
+
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      const StateData::Transition& t = state[i].transition;
+      S8* row = &transitionTable[i << NumTransitionInputBits];
+
+      for (U32 inputs = 0; inputs < TransitionTableSize; inputs++)
+      {
+         // Keep the priority order of the old if/else chain: loaded,
+         // generic triggers, ammo, target, wet, motion, trigger, altTrigger.
+         S32 ns = t.loaded[(inputs & LoadedInput) != 0];
+         for (U32 j = 0; ns == -1 && j < MaxGenericTriggers; j++)
+            ns = t.genericTrigger[j][(inputs & (GenericTriggerInput << j)) != 0];
+         if (ns == -1)
+            ns = t.ammo[(inputs & AmmoInput) != 0];
+         if (ns == -1)
+            ns = t.target[(inputs & TargetInput) != 0];
+         if (ns == -1)
+            ns = t.wet[(inputs & WetInput) != 0];
+         if (ns == -1)
+            ns = t.motion[(inputs & MotionInput) != 0];
+         if (ns == -1)
+            ns = t.trigger[(inputs & TriggerInput) != 0];
+         if (ns == -1)
+            ns = t.altTrigger[(inputs & AltTriggerInput) != 0];
+
+         row[inputs] = (S8)ns;
+      }
+   }
+}
+
+void StateItemData::buildStateNameMap()
+{
+   stateNameMap.clear();
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      const char* name = state[i].name;
+      if (!name || !name[0])
+         continue;
+
+      // First state with a given name wins, same as the old linear scan.
+      StringTableEntry ste = StringTable->insert(name);
+      if (stateNameMap.find(ste) == stateNameMap.end())
+         stateNameMap.insertUnique(ste, i);
+   }
+}
+
+S32 StateItemData::findState(const char* name)
+{
+   if (!name || !name[0])
+      return -1;
+
+   // A name that was never interned can't be one of ours.
+   StringTableEntry ste = StringTable->lookup(name);
+   if (!ste)
+      return -1;
+
+   // Case variants of a name intern to the same entry, so the map is all
+   // we need.
+   StateNameMap::Iterator itr = stateNameMap.find(ste);
+   return (itr != stateNameMap.end()) ? itr->value : -1;
+}
+
 S32 StateItemData::lookupState(const char* name)
 {
    if (!name || !name[0])
       return -1;
-   for (U32 i = 0; i < MaxStates; i++)
-      if (stateName[i] && !dStricmp(name,stateName[i]))
-         return i;
+   S32 index = findState(name);
+   if (index != -1)
+      return index;
    Con::errorf(ConsoleLogEntry::General,"StateItemData:: Could not resolve state \"%s\" for image \"%s\"",name,getName());
    return 0;
 }
@@ -614,6 +956,26 @@ void StateItemData::initPersistFields()
       "@see TurretShape and ProximityMine for examples that should set this to false to allow them to be "
       "shot by projectiles.\n");
 
+   addField("continuousCollision",  TypeBool,  Offset(continuousCollision,  StateItemData),
+      "@brief Use swept collision for this StateItem when it moves fast.\n\n"
+      "Above ccdVelocityThreshold the tick's move is split into substeps, each tested against the "
+      "box swept from its start to its end, so fast items don't pass through thin geometry.  Slower "
+      "items keep the regular test.  The default is false.\n");
+   addField("ccdVelocityThreshold", TypeF32,   Offset(ccdVelocityThreshold, StateItemData),
+      "Speed in meters per second above which continuousCollision is used.");
+   addField("ccdMaxSubsteps",       TypeS32,   Offset(ccdMaxSubsteps,       StateItemData),
+      "Maximum number of substeps a tick's move is split into when continuousCollision is used.");
+
+   addField("netPositionBits",      TypeS32,   Offset(netPositionBits,      StateItemData),
+      "@brief Bits per component of the positions sent to clients, up to 24.\n\n"
+      "Positions are quantized inside netBounds; outside it, or at 0, full floats are sent.  The default is 0.\n");
+   addField("netVelocityBits",      TypeS32,   Offset(netVelocityBits,      StateItemData),
+      "@brief Bits per component of the velocities sent to clients, up to 16.\n\n"
+      "Velocities are quantized relative to maxVelocity, so this needs a maxVelocity.  The default is 0, full floats.\n");
+   addField("netBounds",            TypeBox3F, Offset(netBounds,            StateItemData),
+      "World box positions are quantized in for netPositionBits.  If empty the MissionArea is used, "
+      "with the flight ceiling above and below.\n");
+
    //-JR
    //advanced StateItem support
    addField( "emap", TypeBool, Offset(emap, StateItemData),
@@ -642,6 +1004,15 @@ void StateItemData::initPersistFields()
       "for each instance in use, although for most images only one or two are actually defined.\n\n"
       "@see useEyeNode\n");
 
+   addField( "animCullOffscreen", TypeBool, Offset(animCullOffscreen, StateItemData),
+      "@brief If true, the client doesn't advance animation threads while the item isn't rendered.\n\n"
+      "The skipped time is applied when the item is next rendered.  The default is true.\n");
+   addField( "animLODDistance", TypeF32, Offset(animLODDistance, StateItemData),
+      "Distance from the camera past which animation threads are only advanced every animLODInterval.  "
+      "The default is 0, always every frame.\n");
+   addField( "animLODInterval", TypeF32, Offset(animLODInterval, StateItemData),
+      "Seconds between animation thread updates past animLODDistance.\n");
+
    addField( "scriptAnimTransitionTime", TypeF32, Offset(scriptAnimTransitionTime, StateItemData),
       "@brief The amount of time to transition between the previous sequence and new sequence when the script prefix has changed.\n\n"
       "When setImageScriptAnimPrefix() is used on a ShapeBase that has this image mounted, the image "
@@ -924,6 +1295,43 @@ void StateItemData::initPersistFields()
    Parent::initPersistFields();
 }
 
+bool StateItemData::getNetBounds(Box3F* bounds) const
+{
+   if (netBounds.len_x() > 0.0f && netBounds.len_y() > 0.0f && netBounds.len_z() > 0.0f)
+   {
+      *bounds = netBounds;
+      return true;
+   }
+
+   MissionArea* area = MissionArea::getServerObject();
+   if (!area)
+      return false;
+
+   const RectI& rect = area->getArea();
+   F32 ceiling = area->getFlightCeiling();
+   bounds->set(Point3F(rect.point.x, rect.point.y, -ceiling),
+               Point3F(rect.point.x + rect.extent.x, rect.point.y + rect.extent.y, ceiling));
+   return rect.extent.x > 0 && rect.extent.y > 0 && ceiling > 0.0f;
+}
+
+void StateItemData::fixNetQuantization()
+{
+   netPositionBits = (netPositionBits > 0) ? mClamp(netPositionBits, 1, 24) : 0;
+   netVelocityBits = (netVelocityBits > 0 && maxVelocity > 0) ? mClamp(netVelocityBits, 1, 16) : 0;
+
+   // Datablocks are usually exec'd before the mission is loaded, so the
+   // MissionArea may not be there yet; in that case packData tries once
+   // more before the first client gets us.
+   mNetBoundsPending = false;
+   if (netPositionBits && !getNetBounds(&mNetBounds))
+   {
+      if (MissionArea::getServerObject())
+         netPositionBits = 0;
+      else
+         mNetBoundsPending = true;
+   }
+}
+
 void StateItemData::packData(BitStream* stream)
 {
    Parent::packData(stream);
@@ -950,6 +1358,28 @@ void StateItemData::packData(BitStream* stream)
    
    stream->writeFlag(simpleServerCollision);
 
+   if(stream->writeFlag(continuousCollision))
+   {
+      stream->write(ccdVelocityThreshold);
+      stream->writeRangedU32(ccdMaxSubsteps, 1, 16);
+   }
+
+   // Settled by fixNetQuantization, StateItem::packUpdate goes by the
+   // same fields.
+   if (mNetBoundsPending)
+   {
+      mNetBoundsPending = false;
+      if (!getNetBounds(&mNetBounds))
+         netPositionBits = 0;
+   }
+   if(stream->writeFlag(netPositionBits > 0))
+   {
+      stream->writeRangedU32(netPositionBits, 1, 24);
+      mathWrite(*stream, mNetBounds);
+   }
+   if(stream->writeFlag(netVelocityBits > 0))
+      stream->writeRangedU32(netVelocityBits, 1, 16);
+
    //-JR
    //advanced StateItem support
    if(stream->writeFlag(computeCRC))
@@ -966,6 +1396,13 @@ void StateItemData::packData(BitStream* stream)
 
    stream->writeFlag(animateOnServer);
 
+   stream->writeFlag(animCullOffscreen);
+   if(stream->writeFlag(animLODDistance > 0.0f))
+   {
+      stream->write(animLODDistance);
+      stream->write(animLODInterval);
+   }
+
    stream->write(scriptAnimTransitionTime);
 
    stream->writeFlag(useEyeNode);
@@ -1002,90 +1439,25 @@ void StateItemData::packData(BitStream* stream)
          casing->getId(),DataBlockObjectIdFirst,DataBlockObjectIdLast);
    }
 
-   for (U32 i = 0; i < MaxStates; i++)
-	  if (stream->writeFlag(state[i].name && state[i].name[0])) 
-	  {
-		 StateData& s = state[i];
-		 // States info not needed on the client:
-		 //    s.allowImageChange
-		 //    s.scriptNames
-		 // Transitions are inc. one to account for -1 values
-		 stream->writeString(state[i].name);
-
-		 stream->writeInt(s.transition.loaded[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.loaded[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.ammo[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.ammo[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.target[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.target[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.wet[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.wet[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.trigger[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.trigger[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.altTrigger[0]+1,NumStateBits);
-		 stream->writeInt(s.transition.altTrigger[1]+1,NumStateBits);
-		 stream->writeInt(s.transition.timeout+1,NumStateBits);
-
-        // Most states don't make use of the motion transition.
-        if (stream->writeFlag(s.transition.motion[0] != -1 || s.transition.motion[1] != -1))
-        {
-			// This state does
-			stream->writeInt(s.transition.motion[0]+1,NumStateBits);
-			stream->writeInt(s.transition.motion[1]+1,NumStateBits);
-		 }
-
-		 // Most states don't make use of the generic trigger transitions.  Don't transmit
-		 // if that is the case here.
-		 for (U32 j=0; j<MaxGenericTriggers; ++j)
-		 {
-			if (stream->writeFlag(s.transition.genericTrigger[j][0] != -1 || s.transition.genericTrigger[j][1] != -1))
-			{
-			   stream->writeInt(s.transition.genericTrigger[j][0]+1,NumStateBits);
-			   stream->writeInt(s.transition.genericTrigger[j][1]+1,NumStateBits);
-			}
-		 }
-
-		 if(stream->writeFlag(s.timeoutValue != gDefaultStateData.timeoutValue))
-			stream->write(s.timeoutValue);
-
-		 stream->writeFlag(s.waitForTimeout);
-		 stream->writeFlag(s.fire);
-         stream->writeFlag(s.altFire);
-         stream->writeFlag(s.reload);
-		 stream->writeFlag(s.ejectShell);
-		 stream->writeFlag(s.scaleAnimation);
-		 stream->writeFlag(s.direction);
-         stream->writeFlag(s.sequenceTransitionIn);
-		 stream->writeFlag(s.sequenceTransitionOut);
-		 stream->writeFlag(s.sequenceNeverTransition);
-		 if(stream->writeFlag(s.sequenceTransitionTime != gDefaultStateData.sequenceTransitionTime))
-			stream->write(s.sequenceTransitionTime);
-
-		 stream->writeString(s.shapeSequence);
-		 stream->writeFlag(s.shapeSequenceScale);
-		 if(stream->writeFlag(s.energyDrain != gDefaultStateData.energyDrain))
-			stream->write(s.energyDrain);
-
-		 stream->writeInt(s.loaded,StateData::NumLoadedBits);
-		 stream->writeInt(s.spin,StateData::NumSpinBits);
-		 stream->writeInt(s.recoil,StateData::NumRecoilBits);
-		 if(stream->writeFlag(s.sequence != gDefaultStateData.sequence))
-			stream->writeSignedInt(s.sequence, 16);
-
-		 if(stream->writeFlag(s.sequenceVis != gDefaultStateData.sequenceVis))
-			stream->writeSignedInt(s.sequenceVis,16);
-		 stream->writeFlag(s.flashSequence);
-		 stream->writeFlag(s.ignoreLoadedForReady);
-
-		 if (stream->writeFlag(s.emitter)) {
-			stream->writeRangedU32(packed? SimObjectId(s.emitter):
-								   s.emitter->getId(),DataBlockObjectIdFirst,DataBlockObjectIdLast);
-			stream->write(s.emitterTime);
-			stream->write(s.emitterNode);
-		 }
+   // The states are compiled once, after preload; every connection gets
+   // the same block.  Clients normally have it cached and only need the
+   // hash, demos have no server to ask so they carry the block.
+   if (mStateBlob.empty() && !mStatesPending)
+      compileStateBlob();
 
-		 sfxWrite( stream, s.sound );
-	  }
+   // A client still waiting on the block only has the hash to give; the
+   // demo then takes the states from the cache the block lands in.
+   bool inlineBlob = packed || !StateItemDataCache::smEnabled;
+   if (inlineBlob && mStatesPending)
+   {
+      Con::warnf("StateItemData: states of %s not here yet, the demo will need them cached", getName());
+      inlineBlob = false;
+   }
+   stream->write(U32(mStateBlob.size()));
+   stream->write(U32(mStateBlobHash >> 32));
+   stream->write(U32(mStateBlobHash));
+   if (stream->writeFlag(inlineBlob))
+      stream->write(mStateBlob.size(), mStateBlob.address());
    stream->write(maxConcurrentSounds);
    stream->writeFlag(useRemainderDT);
    //-JR
@@ -1123,6 +1495,22 @@ void StateItemData::unpackData(BitStream* stream)
 
    simpleServerCollision = stream->readFlag();
 
+   continuousCollision = stream->readFlag();
+   if(continuousCollision)
+   {
+      stream->read(&ccdVelocityThreshold);
+      ccdMaxSubsteps = stream->readRangedU32(1, 16);
+   }
+
+   if(stream->readFlag())
+   {
+      netPositionBits = stream->readRangedU32(1, 24);
+      mathRead(*stream, &mNetBounds);
+   }
+   else
+      netPositionBits = 0;
+   netVelocityBits = stream->readFlag() ? stream->readRangedU32(1, 16) : 0;
+
    //-JR
    //advanced StateItem support
    computeCRC = stream->readFlag();
@@ -1144,6 +1532,15 @@ void StateItemData::unpackData(BitStream* stream)
 
    animateOnServer = stream->readFlag();
 
+   animCullOffscreen = stream->readFlag();
+   if(stream->readFlag())
+   {
+      stream->read(&animLODDistance);
+      stream->read(&animLODInterval);
+   }
+   else
+      animLODDistance = 0.0f;
+
    stream->read(&scriptAnimTransitionTime);
 
    useEyeNode = stream->readFlag();
@@ -1178,20 +1575,237 @@ void StateItemData::unpackData(BitStream* stream)
       casingID = stream->readRangedU32(DataBlockObjectIdFirst, DataBlockObjectIdLast);
    }
 
-   for (U32 i = 0; i < MaxStates; i++) {
-	  if (stream->readFlag()) {
-		 StateData& s = state[i];
-		 // States info not needed on the client:
-		 //    s.allowImageChange
-		 //    s.scriptNames
-		 // Transitions are dec. one to restore -1 values
-		 s.name = stream->readSTString();
+   // The states come as one block, kept for repacking.  If it wasn't
+   // sent it comes from the cache, or from the server after preload.
+   U32 blobSize, hashHi, hashLo;
+   stream->read(&blobSize);
+   stream->read(&hashHi);
+   stream->read(&hashLo);
+   mStateBlobHash = (U64(hashHi) << 32) | hashLo;
+
+   mStatesPending = false;
+   bool inlineBlob = stream->readFlag();
+   if (blobSize > StateItemDataCache::MaxStatesSize)
+   {
+      // Not something any server compiles; leave the states unloaded.
+      Con::errorf("StateItemData: states of %s are %d bytes, more than the %d allowed", getName(), blobSize, S32(StateItemDataCache::MaxStatesSize));
+      mStateBlob.clear();
+      mStatesPending = true;
+   }
+   else if (inlineBlob)
+   {
+      mStateBlob.setSize(blobSize);
+      stream->read(blobSize, mStateBlob.address());
+   }
+   else if (!StateItemDataCache::load(mStateBlobHash, blobSize, mStateBlob))
+   {
+      mStateBlob.clear();
+      mStatesPending = true;
+   }
 
-		 s.transition.loaded[0] = stream->readInt(NumStateBits) - 1;
-		 s.transition.loaded[1] = stream->readInt(NumStateBits) - 1;
-		 s.transition.ammo[0] = stream->readInt(NumStateBits) - 1;
-		 s.transition.ammo[1] = stream->readInt(NumStateBits) - 1;
-		 s.transition.target[0] = stream->readInt(NumStateBits) - 1;
+   if (!mStatesPending)
+   {
+      BitStream blobStream(mStateBlob.address(), blobSize);
+      unpackStates(&blobStream);
+   }
+
+   stream->read(&maxConcurrentSounds);
+   useRemainderDT = stream->readFlag();
+
+   statesLoaded = true;
+   //-JR
+}
+
+//-JR
+//advanced StateItem support
+void StateItemData::compileStateBlob()
+{
+   InfiniteBitStream blobStream;
+   packStates(&blobStream);
+
+   mStateBlob.setSize(blobStream.getPosition());
+   dMemcpy(mStateBlob.address(), blobStream.getBuffer(), mStateBlob.size());
+   mStateBlobHash = StateItemDataCache::hash(mStateBlob.address(), mStateBlob.size());
+}
+
+void StateItemData::installStateBlob(const Vector<U8>& blob)
+{
+   mStateBlob = blob;
+   BitStream blobStream(mStateBlob.address(), mStateBlob.size());
+   unpackStates(&blobStream);
+   mStatesPending = false;
+
+   // What onAdd and preload would have done with these states.
+   fireState = altFireState = reloadState = -1;
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      StateData& s = state[i];
+      if (s.emitter && !Sim::findObject(SimObjectId(s.emitter), s.emitter))
+         Con::errorf(ConsoleLogEntry::General, "Error, unable to load emitter for image datablock");
+
+      String str;
+      if( !sfxResolve( &s.sound, str ) )
+         Con::errorf( ConsoleLogEntry::General, str.c_str() );
+
+      if (s.sequence != -1)
+         isAnimated = true;
+      if (s.sequenceVis != -1)
+      {
+         s.flashSequence = true;
+         hasFlash = true;
+      }
+      if (s.emitterNode == -1)
+         s.emitterNode = muzzleNode;
+
+      if (s.fire && fireState == -1)
+         fireState = i;
+      if (s.altFire && altFireState == -1)
+         altFireState = i;
+      if (s.reload && reloadState == -1)
+         reloadState = i;
+   }
+
+   buildStateNameMap();
+   compileTransitionTable();
+   compileReadyTable();
+   bindStateCallbacks();
+
+   // The ghosts made while we waited have been running on no states.
+   StateItemManager::get(false)->resetStates(this);
+}
+
+void StateItemData::packStates(InfiniteBitStream* stream)
+{
+   // Interned strings first, the states refer to them by index.
+   Vector<StringTableEntry> strings;
+   strings.push_back(StringTable->EmptyString());
+   for (U32 i = 0; i < MaxStates; i++)
+   {
+      if (!state[i].name || !state[i].name[0])
+         continue;
+      if (!strings.contains(state[i].name))
+         strings.push_back(state[i].name);
+      if (state[i].shapeSequence && state[i].shapeSequence[0] && !strings.contains(state[i].shapeSequence))
+         strings.push_back(state[i].shapeSequence);
+   }
+
+   stream->validate(1024);
+   stream->writeRangedU32(strings.size(), 1, MaxStrings);
+   for (U32 i = 0; i < strings.size(); i++)
+   {
+      // Up to 255 chars each, room for one at a time.
+      stream->validate(256);
+      stream->writeString(strings[i]);
+   }
+
+   for (U32 i = 0; i < MaxStates; i++)
+	  if (stream->writeFlag(state[i].name && state[i].name[0])) 
+	  {
+		 stream->validate(1024);
+		 StateData& s = state[i];
+		 // States info not needed on the client:
+		 //    s.allowImageChange
+		 //    s.scriptNames
+		 // Transitions are inc. one to account for -1 values
+		 stream->writeRangedU32(strings.find_next(state[i].name), 0, MaxStrings - 1);
+
+		 stream->writeInt(s.transition.loaded[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.loaded[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.ammo[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.ammo[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.target[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.target[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.wet[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.wet[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.trigger[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.trigger[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.altTrigger[0]+1,NumStateBits);
+		 stream->writeInt(s.transition.altTrigger[1]+1,NumStateBits);
+		 stream->writeInt(s.transition.timeout+1,NumStateBits);
+
+        // Most states don't make use of the motion transition.
+        if (stream->writeFlag(s.transition.motion[0] != -1 || s.transition.motion[1] != -1))
+        {
+			// This state does
+			stream->writeInt(s.transition.motion[0]+1,NumStateBits);
+			stream->writeInt(s.transition.motion[1]+1,NumStateBits);
+		 }
+
+		 // Most states don't make use of the generic trigger transitions.  Don't transmit
+		 // if that is the case here.
+		 for (U32 j=0; j<MaxGenericTriggers; ++j)
+		 {
+			if (stream->writeFlag(s.transition.genericTrigger[j][0] != -1 || s.transition.genericTrigger[j][1] != -1))
+			{
+			   stream->writeInt(s.transition.genericTrigger[j][0]+1,NumStateBits);
+			   stream->writeInt(s.transition.genericTrigger[j][1]+1,NumStateBits);
+			}
+		 }
+
+		 if(stream->writeFlag(s.timeoutValue != gDefaultStateData.timeoutValue))
+			stream->write(s.timeoutValue);
+
+		 stream->writeFlag(s.waitForTimeout);
+		 stream->writeFlag(s.fire);
+         stream->writeFlag(s.altFire);
+         stream->writeFlag(s.reload);
+		 stream->writeFlag(s.ejectShell);
+		 stream->writeFlag(s.scaleAnimation);
+		 stream->writeFlag(s.direction);
+         stream->writeFlag(s.sequenceTransitionIn);
+		 stream->writeFlag(s.sequenceTransitionOut);
+		 stream->writeFlag(s.sequenceNeverTransition);
+		 if(stream->writeFlag(s.sequenceTransitionTime != gDefaultStateData.sequenceTransitionTime))
+			stream->write(s.sequenceTransitionTime);
+
+		 stream->writeRangedU32((s.shapeSequence && s.shapeSequence[0]) ? strings.find_next(s.shapeSequence) : 0, 0, MaxStrings - 1);
+		 stream->writeFlag(s.shapeSequenceScale);
+		 if(stream->writeFlag(s.energyDrain != gDefaultStateData.energyDrain))
+			stream->write(s.energyDrain);
+
+		 stream->writeInt(s.loaded,StateData::NumLoadedBits);
+		 stream->writeInt(s.spin,StateData::NumSpinBits);
+		 stream->writeInt(s.recoil,StateData::NumRecoilBits);
+		 if(stream->writeFlag(s.sequence != gDefaultStateData.sequence))
+			stream->writeSignedInt(s.sequence, 16);
+
+		 if(stream->writeFlag(s.sequenceVis != gDefaultStateData.sequenceVis))
+			stream->writeSignedInt(s.sequenceVis,16);
+		 stream->writeFlag(s.flashSequence);
+		 stream->writeFlag(s.ignoreLoadedForReady);
+
+		 if (stream->writeFlag(s.emitter)) {
+			stream->writeRangedU32(packed? SimObjectId(s.emitter):
+								   s.emitter->getId(),DataBlockObjectIdFirst,DataBlockObjectIdLast);
+			stream->write(s.emitterTime);
+			stream->write(s.emitterNode);
+		 }
+
+		 sfxWrite( stream, s.sound );
+	  }
+}
+
+void StateItemData::unpackStates(BitStream* stream)
+{
+   Vector<StringTableEntry> strings;
+   strings.setSize(stream->readRangedU32(1, MaxStrings));
+   for (U32 i = 0; i < strings.size(); i++)
+      strings[i] = stream->readSTString();
+
+   for (U32 i = 0; i < MaxStates; i++) {
+	  if (stream->readFlag()) {
+		 StateData& s = state[i];
+		 // States info not needed on the client:
+		 //    s.allowImageChange
+		 //    s.scriptNames
+		 // Transitions are dec. one to restore -1 values
+		 s.name = strings[stream->readRangedU32(0, MaxStrings - 1)];
+
+		 s.transition.loaded[0] = stream->readInt(NumStateBits) - 1;
+		 s.transition.loaded[1] = stream->readInt(NumStateBits) - 1;
+		 s.transition.ammo[0] = stream->readInt(NumStateBits) - 1;
+		 s.transition.ammo[1] = stream->readInt(NumStateBits) - 1;
+		 s.transition.target[0] = stream->readInt(NumStateBits) - 1;
 		 s.transition.target[1] = stream->readInt(NumStateBits) - 1;
 		 s.transition.wet[0] = stream->readInt(NumStateBits) - 1;
 		 s.transition.wet[1] = stream->readInt(NumStateBits) - 1;
@@ -1249,7 +1863,7 @@ void StateItemData::unpackData(BitStream* stream)
 		 else
 			s.sequenceTransitionTime = gDefaultStateData.sequenceTransitionTime;
 
-		 s.shapeSequence = stream->readSTString();
+		 s.shapeSequence = strings[stream->readRangedU32(0, MaxStrings - 1)];
 		 s.shapeSequenceScale = stream->readFlag();
 
 		 if(stream->readFlag())
@@ -1286,19 +1900,15 @@ void StateItemData::unpackData(BitStream* stream)
 	  }
    }
    
-   stream->read(&maxConcurrentSounds);
-   useRemainderDT = stream->readFlag();
-
-   statesLoaded = true;
-   //-JR
 }
 
-//-JR
-//advanced StateItem support
 void StateItemData::inspectPostApply()
 {
    Parent::inspectPostApply();
 
+   // Edited in the inspector, the compiled states are out of date.
+   mStateBlob.clear();
+
    addField( "emap", TypeBool, Offset(emap, StateItemData),
       "Whether to enable environment mapping on this Image." );
 
@@ -1576,6 +2186,9 @@ StateItem::StateItem()
 {
    mTypeMask |= ItemObjectType;
    mDataBlock = 0;
+#ifdef STATEITEM_PROFILE
+   mProfileStateEnter = 0;
+#endif
    mStatic = false;
    mRotate = false;
    mVelocity = VectorF(0,0,0);
@@ -1593,35 +2206,44 @@ StateItem::StateItem()
    mWorkingQueryBox.maxExtents.set(-1e9, -1e9, -1e9);
 
    mLight = NULL;
+   mLightAdmitted = false;
 
    mSubclassItemHandlesScene = true;
 
    //Advanced StateItem Support -JR
-   state = nextState = NULL;
-   loaded = false;
+   // The state machine fields are defaulted when the datablock
+   // puts us in a StateItemManager batch.
+   mBatch = NULL;
+   mBatchSlot = 0;
+   mSleeping = false;
+   nextState = NULL;
    nextLoaded = false;
-   delayTime = 0.0f;
-   fireCount = 0;
    altFireCount = 0;
    reloadCount = 0;
-   triggerDown = altTriggerDown = false;
+   mNetFireCount = 0;
    ambientThread=visThread=animThread=flashThread=spinThread = NULL;
-   lightStart = 0;
-   animLoopingSound = false;
-   ammo = false;
-   target = false;
-   wet = false;
-   motion = false;
-
-   for (U32 i=0; i<StateItemData::MaxGenericTriggers; ++i)
+   mAnimPendingDt = 0.0f;
+   mAnimVisible = false;
+   mAnimCameraDistSq = 0.0f;
+   for (U32 i = 0; i < MaxCachedTransforms; i++)
    {
-      genericTrigger[i] = false;
+      mTransformCache[i].node = -1;
+      mTransformCache[i].generation = 0;
    }
+   mTransformCacheNext = 0;
+   mRenderGeneration = 1;
+   lightStart = 0;
+   animLoopingSound = false;
    //-JR
 }
 
 StateItem::~StateItem()
 {
+   // Ghosts join a batch on their first unpack, before onAdd, so
+   // one that never got added still has to leave it.
+   if (mBatch)
+      StateItemManager::get(isServerObject())->removeItem(this);
+
    SAFE_DELETE(mLight);
 }
 
@@ -1639,7 +2261,7 @@ bool StateItem::onAdd()
       scriptOnAdd();
 
    if(mDataBlock->state[0].name)
-      state = &mDataBlock->state[0];
+      mBatch->stateIndex[mBatchSlot] = 0;
 
    return true;
 }
@@ -1688,6 +2310,17 @@ bool StateItem::onNewDataBlock( GameBaseData *dptr, bool reload )
    if (!mDataBlock || !Parent::onNewDataBlock(dptr,reload))
       return false;
 
+   StateItemManager::get(isServerObject())->addItem(this);
+
+   // Only lit items compete for the light budget.
+   if (isGhost())
+   {
+      if (mDataBlock->lightType != StateItemData::NoLight)
+         StateItemLightBudget::get()->addItem(this);
+      else
+         StateItemLightBudget::get()->removeItem(this);
+   }
+
    scriptOnNewDataBlock();
 
    if ( isProperlyAdded() )
@@ -1701,6 +2334,15 @@ void StateItem::onRemove()
    scriptOnRemove();
    removeFromScene();
 
+   StateItemManager::get(isServerObject())->removeItem(this);
+   if (isGhost())
+   {
+      StateItemManager::get(false)->removeMounted(this);
+      StateItemLightBudget::get()->removeItem(this);
+      StateItemVoicePool::get()->stopOwner(this);
+      StateItemEmitterPool::get()->releaseOwner(this);
+   }
+
    Parent::onRemove();
 }
 
@@ -1783,6 +2425,7 @@ void StateItem::setVelocity(const VectorF& vel)
    setMaskBits(PositionMask);
    mAtRest = false;
    mAtRestCounter = 0;
+   wakeUp();
 }
 
 void StateItem::applyImpulse(const Point3F&,const VectorF& vec)
@@ -1792,6 +2435,7 @@ void StateItem::applyImpulse(const Point3F&,const VectorF& vec)
    vel.x = vec.x / mDataBlock->mass;
    vel.y = vec.y / mDataBlock->mass;
    vel.z = vec.z / mDataBlock->mass;
+   StateItemRecorder::recordImpulse(this, vel);
    setVelocity(vel);
 }
 
@@ -1805,74 +2449,49 @@ void StateItem::setCollisionTimeout(ShapeBase* obj)
 
 void StateItem::processTick(const Move* move)
 {
-   Parent::processTick(move);
+   // Item::processTick would simulate Item's own copy of the physics
+   // state, which we shadow.  Our simulation is run for all moving items
+   // at once by StateItemManager, see isMoving().
+   ShapeBase::processTick(move);
 
-   /*if(!isMounted())
-   {
-	   // Warp to catch up to server
-	   if (delta.warpTicks > 0)
-	   {
-		  delta.warpTicks--;
-
-		  // Set new pos.
-		  MatrixF mat = mObjToWorld;
-		  mat.getColumn(3,&delta.pos);
-		  delta.pos += delta.warpOffset;
-		  mat.setColumn(3,delta.pos);
-		  Parent::setTransform(mat);
-
-		  // Backstepping
-		  delta.posVec.x = -delta.warpOffset.x;
-		  delta.posVec.y = -delta.warpOffset.y;
-		  delta.posVec.z = -delta.warpOffset.z;
-	   }
-	   else
-	   {
-		  //-JR
-		  /*if (isMounted()) {
-			  MatrixF mat;
-			  mMount.object->getMountTransform( mMount.node, mMount.xfm, &mat );
+   if (isMounted())
+      return;
 
-			  //apply offset
-			  mat.mul(mDataBlock->mountOffset);
+   if (mCollisionObject && !--mCollisionTimeout)
+      mCollisionObject = 0;
 
-			  Parent::setTransform(mat);
-			  Parent::setRenderTransform(mat);
-		  }
-		  else/*-JR*//* if (isServerObject() && mAtRest && (mStatic == false && mDataBlock->sticky == false))
-		  {
-			 if (++mAtRestCounter > csmAtRestTimer)
-			 {
-				mAtRest = false;
-				mAtRestCounter = 0;
-				setMaskBits(PositionMask);
-			 }
-		  }
+   // Warp to catch up to server
+   if (delta.warpTicks > 0)
+   {
+      delta.warpTicks--;
 
-		  if (!mStatic && !mAtRest && isHidden() == false)
-		  {
-			 updateVelocity(TickSec);
-			 updateWorkingCollisionSet(isGhost() ? sClientCollisionMask : sServerCollisionMask, TickSec);
-			 updatePos(isGhost() ? sClientCollisionMask : sServerCollisionMask, TickSec);
-		  }
-		  else
-		  {
-			 // Need to clear out last updatePos or warp interpolation
-			 delta.posVec.set(0,0,0);
-		  }
-	   }
+      // Set new pos.
+      MatrixF mat = mObjToWorld;
+      mat.getColumn(3,&delta.pos);
+      delta.pos += delta.warpOffset;
+      mat.setColumn(3,delta.pos);
+      Parent::setTransform(mat);
+
+      // Backstepping
+      delta.posVec.x = -delta.warpOffset.x;
+      delta.posVec.y = -delta.warpOffset.y;
+      delta.posVec.z = -delta.warpOffset.z;
+      return;
    }
-   else{
-	  MatrixF mat;
-	  mMount.object->getMountTransform( mMount.node, mMount.xfm, &mat );
-	  getRenderMountTransform( 0.0f, data.mountPoint, MatrixF::Identity, &nmat );
 
-	  //apply offset
-      mat.mul(mDataBlock->mountOffset);
+   if (isServerObject() && mAtRest && (mStatic == false && mDataBlock->sticky == false))
+   {
+      if (++mAtRestCounter > csmAtRestTimer)
+      {
+         mAtRest = false;
+         mAtRestCounter = 0;
+         setMaskBits(PositionMask);
+      }
+   }
 
-	  Parent::setTransform(mat);
-	  //Parent::setRenderTransform(mat);
-   }*/
+   // Need to clear out last move or warp interpolation
+   if (!isMoving())
+      delta.posVec.set(0,0,0);
 }
 
 void StateItem::interpolateTick(F32 dt)
@@ -1912,14 +2531,14 @@ void StateItem::interpolateTick(F32 dt)
 	  mat.mul(mDataBlock->mountOffset);
 
       Parent::setTransform(mat);
-      Parent::setRenderTransform(mat);
+      setRenderTransform(mat);
    }
    if (isMounted()) {
       MatrixF mat;
       mMount.object->getRenderMountTransform( 0, mMount.node, mMount.xfm, &mat );
 	  mat.mul(mDataBlock->mountOffset);
 
-      Parent::setRenderTransform(mat);
+      setRenderTransform(mat);
    }*/
    //-JR
 }
@@ -1946,6 +2565,7 @@ void StateItem::setTransform(const MatrixF& mat)
    {
       mAtRest = false;
       mAtRestCounter = 0;
+      wakeUp();
    }
 
    if ( mPhysicsRep )
@@ -1954,9 +2574,73 @@ void StateItem::setTransform(const MatrixF& mat)
    setMaskBits(/*-JR todo: reimplement //RotationMask -JR |*/ PositionMask | NoWarpMask);
 }
 
+void StateItem::setRenderTransform(const MatrixF &mat)
+{
+   Parent::setRenderTransform(mat);
+   invalidateRenderTransforms();
+}
+
+void StateItem::onMount( SceneObject *obj, S32 node )
+{
+   Parent::onMount( obj, node );
+
+   // Mounted items follow their mount every tick.
+   wakeUp();
+
+   if (isGhost())
+      StateItemManager::get(false)->addMounted(this);
+   else
+      StateItemRecorder::recordMount(this, obj);
+}
+
+void StateItem::onCollision( SceneObject *object, const VectorF &vec )
+{
+   // Whatever hit us may have pushed us or tripped a state script, and a
+   // sleeping item would otherwise not notice until something else pokes
+   // it.  Impulses wake us through setVelocity.
+   wakeUp();
+
+   Parent::onCollision( object, vec );
+}
+
+void StateItem::onUnmount( SceneObject *obj, S32 node )
+{
+   if (isGhost())
+      StateItemManager::get(false)->removeMounted(this);
+   else
+      StateItemRecorder::recordMount(this, NULL);
+
+   Parent::onUnmount( obj, node );
+}
+
+void StateItem::updateMountTransform(F32 dt)
+{
+   MatrixF mat;
+   mMount.object->getRenderMountTransform( dt, mMount.node, mMount.xfm, &mat );
+
+   //apply offset
+   mat.mul(mDataBlock->mountOffset);
+
+   Parent::setTransform(mat);
+   setRenderTransform(mat);
+
+   updateEmitters(dt);
+}
+
 
 //----------------------------------------------------------------------------
-void StateItem::updateWorkingCollisionSet(const U32 mask, const F32 dt)
+
+bool StateItem::isMoving()
+{
+   return isProperlyAdded() && !mStatic && !mAtRest && !isHidden() && !isMounted() && delta.warpTicks <= 0;
+}
+
+U32 StateItem::getCollisionMask() const
+{
+   return isGhost() ? sClientCollisionMask : sServerCollisionMask;
+}
+
+bool StateItem::updateWorkingQueryBox(const F32 dt)
 {
    // It is assumed that we will never accelerate more than 10 m/s for gravity...
    //
@@ -1968,61 +2652,46 @@ void StateItem::updateWorkingCollisionSet(const U32 mask, const F32 dt)
    //  or if we can use the cached version from the last query.  We use the x
    //  component of the min member of the mWorkingQueryBox, which is lame, but
    //  it works ok.
-   bool updateSet = false;
-
    Box3F convexBox = mConvex.getBoundingBox(getTransform(), getScale());
    F32 l = (newLen * 1.1) + 0.1;  // from Convex::updateWorkingList
    convexBox.minExtents -= Point3F(l, l, l);
    convexBox.maxExtents += Point3F(l, l, l);
 
-   // Check containment
-   {
-      if (mWorkingQueryBox.minExtents.x != -1e9)
-      {
-         if (mWorkingQueryBox.isContained(convexBox) == false)
-         {
-            // Needed region is outside the cached region.  Update it.
-            updateSet = true;
-         }
-         else
-         {
-            // We can leave it alone, we're still inside the cached region
-         }
-      }
-      else
-      {
-         // Must update
-         updateSet = true;
-      }
-   }
-
-   // Actually perform the query, if necessary
-   if (updateSet == true)
-   {
-      mWorkingQueryBox = convexBox;
-      mWorkingQueryBox.minExtents -= Point3F(2 * l, 2 * l, 2 * l);
-      mWorkingQueryBox.maxExtents += Point3F(2 * l, 2 * l, 2 * l);
+   // We can leave it alone if we're still inside the cached region
+   if (mWorkingQueryBox.minExtents.x != -1e9 && mWorkingQueryBox.isContained(convexBox))
+      return false;
 
-      disableCollision();
-      if (mCollisionObject)
-         mCollisionObject->disableCollision();
+   mWorkingQueryBox = convexBox;
+   mWorkingQueryBox.minExtents -= Point3F(2 * l, 2 * l, 2 * l);
+   mWorkingQueryBox.maxExtents += Point3F(2 * l, 2 * l, 2 * l);
+   return true;
+}
 
-      mConvex.updateWorkingList(mWorkingQueryBox, mask);
+void StateItem::updateWorkingCollisionSet(const Vector<SceneObject*>& candidates)
+{
+   // Clear objects off the working list that are no longer intersecting,
+   // same as Convex::updateWorkingList.
+   CollisionWorkingList& wl = mConvex.getWorkingList();
+   for (CollisionWorkingList* itr = wl.wLink.mNext; itr != &wl; itr = itr->wLink.mNext) {
+      SceneObject* obj = itr->mConvex->getObject();
+      if (!mWorkingQueryBox.isOverlapped(itr->mConvex->getBoundingBox()) ||
+          !obj->isCollisionEnabled() || obj == mCollisionObject) {
+         CollisionWorkingList* cl = itr;
+         itr = itr->wLink.mPrev;
+         cl->free();
+      }
+   }
 
-	  //-JR
-      /*if (mCollisionObject)
-         mCollisionObject->enableCollision();
-      enableCollision();*/
-	  SceneObject* mountedObject = getMountedObject(0);  
-      SimObjectId mountedId = mountedObject?mountedObject->getId():0;  
-  
-      SceneObject* mountingObject = mMount.object;  
-      SimObjectId mountingId = mountingObject?mountingObject->getId():0;  
-  
-      mConvex.updateWorkingList(mWorkingQueryBox,  
-         isGhost() ? sClientCollisionMask : sServerCollisionMask/*,mountedId,mountingId*/);  
-      enableCollision();
-	  //-JR
+   // The candidates cover everyone sharing our broadphase cell, so
+   // only take the ones that reach into our own query box.
+   U32 mask = getCollisionMask();
+   for (U32 i = 0; i < candidates.size(); i++) {
+      SceneObject* obj = candidates[i];
+      if (obj == this || obj == mCollisionObject || !(obj->getTypeMask() & mask))
+         continue;
+      if (!obj->isCollisionEnabled() || !mWorkingQueryBox.isOverlapped(obj->getWorldBox()))
+         continue;
+      obj->buildConvex(mWorkingQueryBox, &mConvex);
    }
 }
 
@@ -2043,25 +2712,22 @@ void StateItem::updateVelocity(const F32 dt)
 }
 
 
-void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
+void StateItem::beginMove(const F32 dt)
 {
    // Try and move
    Point3F pos;
    mObjToWorld.getColumn(3,&pos);
    delta.posVec = pos;
 
-   bool contact = false;
-   bool nonStatic = false;
-   bool stickyNotify = false;
-   CollisionList collisionList;
-   F32 time = dt;
+   mMove.contact = false;
+   mMove.nonStatic = false;
+   mMove.stickyNotify = false;
+   mMove.doToughCollision = true;
+   mMove.hitCount = 0;
 
-   static Polyhedron sBoxPolyhedron;
-   static ExtrudedPolyList sExtrudedPolyList;
-   static EarlyOutPolyList sEarlyOutPolyList;
    MatrixF collisionMatrix(true);
-   Point3F end = pos + mVelocity * time;
-   U32 mask = isServerObject() ? sServerCollisionMask : sClientCollisionMask;
+   Point3F end = pos + mVelocity * dt;
+   U32 mask = getCollisionMask();
 
    // Part of our speed problem here is that we don't track contact surfaces, like we do
    //  with the player.  In order to handle the most common and performance impacting
@@ -2069,6 +2735,8 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
    //  us.  This won't be perfect, but it only needs to catch a few of these to make a
    //  big difference.  We'll cast from the top center of the bounding box at the tick's
    //  beginning to the bottom center of the box at the end.
+   //
+   // This stays on the main thread, the container's ray cast isn't reentrant.
    Point3F startCast((mObjBox.minExtents.x + mObjBox.maxExtents.x) * 0.5,
                      (mObjBox.minExtents.y + mObjBox.maxExtents.y) * 0.5,
                      mObjBox.maxExtents.z);
@@ -2080,7 +2748,6 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
    collisionMatrix.setColumn(3, end);
    collisionMatrix.mulP(endCast);
    RayInfo rinfo;
-   bool doToughCollision = true;
    disableCollision();
    if (mCollisionObject)
       mCollisionObject->disableCollision();
@@ -2095,10 +2762,10 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
             mVelocity.set(0, 0, 0);
             mAtRest = true;
             mAtRestCounter = 0;
-            stickyNotify = true;
+            mMove.stickyNotify = true;
             mStickyCollisionPos    = rinfo.point;
             mStickyCollisionNormal = rinfo.normal;
-            doToughCollision = false;
+            mMove.doToughCollision = false;
          } else {
             // Subtract out velocity into surface and friction
             VectorF fv = mVelocity + rinfo.normal * bd;
@@ -2116,10 +2783,10 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
             mVelocity -= fv;
 
             // Keep track of what we hit
-            contact = true;
+            mMove.contact = true;
             U32 typeMask = rinfo.object->getTypeMask();
             if (!(typeMask & StaticObjectType))
-               nonStatic = true;
+               mMove.nonStatic = true;
             if (isServerObject() && (typeMask & ShapeBaseObjectType)) {
                ShapeBase* col = static_cast<ShapeBase*>(rinfo.object);
                queueCollision(col,mVelocity - col->getVelocity());
@@ -2131,147 +2798,221 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
    if (mCollisionObject)
       mCollisionObject->enableCollision();
 
-   if (doToughCollision)
+   mMove.pos = pos;
+}
+
+void StateItem::sweepMove(StateItemCollisionScratch& scratch, const F32 dt)
+{
+   if (!mMove.doToughCollision)
+      return;
+
+   // Only touches this item and its working list; the other objects are
+   // read through their convexes, nothing is queued or called back.
+   //
+   // Fast items with continuousCollision split the tick into substeps no
+   // longer than half their smallest extent, and test each one against the
+   // box swept over it, so they can't skip over thin geometry.
+   U32 steps = 1;
+   bool swept = false;
+   if (mDataBlock->continuousCollision)
    {
-      U32 count;
-      for (count = 0; count < 3; count++)
+      F32 speed = mVelocity.len();
+      if (speed > mDataBlock->ccdVelocityThreshold)
       {
-         // Build list from convex states here...
-         end = pos + mVelocity * time;
+         Point3F extents = mObjBox.getExtents();
+         F32 stepLen = getMax(getMin(extents.x, getMin(extents.y, extents.z)) * 0.5f, 0.01f);
+         steps = mClamp(S32(mCeil(speed * dt / stepLen)), 1, mDataBlock->ccdMaxSubsteps);
+         swept = true;
+      }
+   }
+
+   Point3F pos = mMove.pos;
+   F32 stepDt = dt / steps;
+   for (U32 i = 0; i < steps; i++)
+      if (!sweepStep(scratch, pos, stepDt, swept))
+         break;
+
+   mMove.pos = pos;
+}
+
+bool StateItem::sweepStep(StateItemCollisionScratch& scratch, Point3F& pos, F32 time, bool swept)
+{
+   MatrixF collisionMatrix(true);
+   Point3F end;
+   U32 mask = getCollisionMask();
+
+   for (U32 count = 0; count < 3; count++)
+   {
+      // Build list from convex states here...
+      end = pos + mVelocity * time;
 
+      collisionMatrix.setColumn(3, end);
+      Box3F wBox = getObjBox();
+      collisionMatrix.mul(wBox);
 
-         collisionMatrix.setColumn(3, end);
-         Box3F wBox = getObjBox();
-         collisionMatrix.mul(wBox);
-         Box3F testBox = wBox;
+      Box3F testBox = wBox;
+      if (swept)
+      {
+         // The box covering the whole move, start to end.
+         testBox.minExtents.setMin(wBox.minExtents - (mVelocity * time));
+         testBox.maxExtents.setMax(wBox.maxExtents - (mVelocity * time));
+      }
+      else
+      {
          Point3F oldMin = testBox.minExtents;
          Point3F oldMax = testBox.maxExtents;
          testBox.minExtents.setMin(oldMin + (mVelocity * time));
          testBox.maxExtents.setMin(oldMax + (mVelocity * time));
+      }
 
-         sEarlyOutPolyList.clear();
-         sEarlyOutPolyList.mNormal.set(0,0,0);
-         sEarlyOutPolyList.mPlaneList.setSize(6);
-         sEarlyOutPolyList.mPlaneList[0].set(wBox.minExtents,VectorF(-1,0,0));
-         sEarlyOutPolyList.mPlaneList[1].set(wBox.maxExtents,VectorF(0,1,0));
-         sEarlyOutPolyList.mPlaneList[2].set(wBox.maxExtents,VectorF(1,0,0));
-         sEarlyOutPolyList.mPlaneList[3].set(wBox.minExtents,VectorF(0,-1,0));
-         sEarlyOutPolyList.mPlaneList[4].set(wBox.minExtents,VectorF(0,0,-1));
-         sEarlyOutPolyList.mPlaneList[5].set(wBox.maxExtents,VectorF(0,0,1));
-
-         CollisionWorkingList& eorList = mConvex.getWorkingList();
-         CollisionWorkingList* eopList = eorList.wLink.mNext;
-         while (eopList != &eorList) {
-            if ((eopList->mConvex->getObject()->getTypeMask() & mask) != 0)
+      // The early out normally only checks where the box ends up, swept
+      // moves check everything in between as well.
+      const Box3F& eoBox = swept ? testBox : wBox;
+
+      EarlyOutPolyList& earlyOutPolyList = scratch.earlyOutPolyList;
+      earlyOutPolyList.clear();
+      earlyOutPolyList.mNormal.set(0,0,0);
+      earlyOutPolyList.mPlaneList.setSize(6);
+      earlyOutPolyList.mPlaneList[0].set(eoBox.minExtents,VectorF(-1,0,0));
+      earlyOutPolyList.mPlaneList[1].set(eoBox.maxExtents,VectorF(0,1,0));
+      earlyOutPolyList.mPlaneList[2].set(eoBox.maxExtents,VectorF(1,0,0));
+      earlyOutPolyList.mPlaneList[3].set(eoBox.minExtents,VectorF(0,-1,0));
+      earlyOutPolyList.mPlaneList[4].set(eoBox.minExtents,VectorF(0,0,-1));
+      earlyOutPolyList.mPlaneList[5].set(eoBox.maxExtents,VectorF(0,0,1));
+
+      CollisionWorkingList& eorList = mConvex.getWorkingList();
+      CollisionWorkingList* eopList = eorList.wLink.mNext;
+      while (eopList != &eorList) {
+         if ((eopList->mConvex->getObject()->getTypeMask() & mask) != 0)
+         {
+            Box3F convexBox = eopList->mConvex->getBoundingBox();
+            if (testBox.isOverlapped(convexBox))
             {
-               Box3F convexBox = eopList->mConvex->getBoundingBox();
-               if (testBox.isOverlapped(convexBox))
-               {
-                  eopList->mConvex->getPolyList(&sEarlyOutPolyList);
-                  if (sEarlyOutPolyList.isEmpty() == false)
-                     break;
-               }
+               eopList->mConvex->getPolyList(&earlyOutPolyList);
+               if (earlyOutPolyList.isEmpty() == false)
+                  break;
             }
-            eopList = eopList->wLink.mNext;
-         }
-         if (sEarlyOutPolyList.isEmpty())
-         {
-            pos = end;
-            break;
          }
+         eopList = eopList->wLink.mNext;
+      }
+      if (earlyOutPolyList.isEmpty())
+      {
+         pos = end;
+         return true;
+      }
 
-         collisionMatrix.setColumn(3, pos);
-         sBoxPolyhedron.buildBox(collisionMatrix, mObjBox);
+      collisionMatrix.setColumn(3, pos);
+      scratch.boxPolyhedron.buildBox(collisionMatrix, mObjBox);
 
-         // Build extruded polyList...
-         VectorF vector = end - pos;
-         sExtrudedPolyList.extrude(sBoxPolyhedron, vector);
-         sExtrudedPolyList.setVelocity(mVelocity);
-         sExtrudedPolyList.setCollisionList(&collisionList);
+      // Build extruded polyList...
+      CollisionList& collisionList = scratch.collisionList;
+      VectorF vector = end - pos;
+      scratch.extrudedPolyList.extrude(scratch.boxPolyhedron, vector);
+      scratch.extrudedPolyList.setVelocity(mVelocity);
+      scratch.extrudedPolyList.setCollisionList(&collisionList);
 
-         CollisionWorkingList& rList = mConvex.getWorkingList();
-         CollisionWorkingList* pList = rList.wLink.mNext;
-         while (pList != &rList) {
-            if ((pList->mConvex->getObject()->getTypeMask() & mask) != 0)
+      CollisionWorkingList& rList = mConvex.getWorkingList();
+      CollisionWorkingList* pList = rList.wLink.mNext;
+      while (pList != &rList) {
+         if ((pList->mConvex->getObject()->getTypeMask() & mask) != 0)
+         {
+            Box3F convexBox = pList->mConvex->getBoundingBox();
+            if (testBox.isOverlapped(convexBox))
             {
-               Box3F convexBox = pList->mConvex->getBoundingBox();
-               if (testBox.isOverlapped(convexBox))
-               {
-                  pList->mConvex->getPolyList(&sExtrudedPolyList);
-               }
+               pList->mConvex->getPolyList(&scratch.extrudedPolyList);
             }
-            pList = pList->wLink.mNext;
          }
+         pList = pList->wLink.mNext;
+      }
 
-         if (collisionList.getTime() < 1.0)
-         {
-            // Set to collision point
-            F32 dt = time * collisionList.getTime();
-            pos += mVelocity * dt;
-            time -= dt;
-
-            // Pick the most resistant surface
-            F32 bd = 0;
-            const Collision* collision = 0;
-            for (int c = 0; c < collisionList.getCount(); c++) {
-               const Collision &cp = collisionList[c];
-               F32 dot = -mDot(mVelocity,cp.normal);
-               if (dot > bd) {
-                  bd = dot;
-                  collision = &cp;
-               }
+      if (collisionList.getTime() < 1.0)
+      {
+         // Set to collision point
+         F32 dt = time * collisionList.getTime();
+         pos += mVelocity * dt;
+         time -= dt;
+
+         // Pick the most resistant surface
+         F32 bd = 0;
+         const Collision* collision = 0;
+         for (int c = 0; c < collisionList.getCount(); c++) {
+            const Collision &cp = collisionList[c];
+            F32 dot = -mDot(mVelocity,cp.normal);
+            if (dot > bd) {
+               bd = dot;
+               collision = &cp;
             }
+         }
 
-            if (collision && mDataBlock->sticky && collision->object->getTypeMask() & (STATIC_COLLISION_TYPEMASK)) {
-               mVelocity.set(0, 0, 0);
-               mAtRest = true;
-               mAtRestCounter = 0;
-               stickyNotify = true;
-               mStickyCollisionPos    = collision->point;
-               mStickyCollisionNormal = collision->normal;
-               break;
-            } else {
-               // Subtract out velocity into surface and friction
-               if (collision) {
-                  VectorF fv = mVelocity + collision->normal * bd;
-                  F32 fvl = fv.len();
-                  if (fvl) {
-                     F32 ff = bd * mDataBlock->friction;
-                     if (ff < fvl) {
-                        fv *= ff / fvl;
-                        fvl = ff;
-                     }
+         if (collision && mDataBlock->sticky && collision->object->getTypeMask() & (STATIC_COLLISION_TYPEMASK)) {
+            mVelocity.set(0, 0, 0);
+            mAtRest = true;
+            mAtRestCounter = 0;
+            mMove.stickyNotify = true;
+            mStickyCollisionPos    = collision->point;
+            mStickyCollisionNormal = collision->normal;
+            return false;
+         } else {
+            // Subtract out velocity into surface and friction
+            if (collision) {
+               VectorF fv = mVelocity + collision->normal * bd;
+               F32 fvl = fv.len();
+               if (fvl) {
+                  F32 ff = bd * mDataBlock->friction;
+                  if (ff < fvl) {
+                     fv *= ff / fvl;
+                     fvl = ff;
                   }
-                  bd *= 1 + mDataBlock->elasticity;
-                  VectorF dv = collision->normal * (bd + 0.002);
-                  mVelocity += dv;
-                  mVelocity -= fv;
-
-                  // Keep track of what we hit
-                  contact = true;
-                  U32 typeMask = collision->object->getTypeMask();
-                  if (!(typeMask & StaticObjectType))
-                     nonStatic = true;
-                  if (isServerObject() && (typeMask & ShapeBaseObjectType)) {
-                     ShapeBase* col = static_cast<ShapeBase*>(collision->object);
-                     queueCollision(col,mVelocity - col->getVelocity());
+               }
+               bd *= 1 + mDataBlock->elasticity;
+               VectorF dv = collision->normal * (bd + 0.002);
+               mVelocity += dv;
+               mVelocity -= fv;
+
+               // Keep track of what we hit, the collision gets queued in endMove
+               mMove.contact = true;
+               U32 typeMask = collision->object->getTypeMask();
+               if (!(typeMask & StaticObjectType))
+                  mMove.nonStatic = true;
+               if (isServerObject() && (typeMask & ShapeBaseObjectType)) {
+                  ShapeBase* col = static_cast<ShapeBase*>(collision->object);
+                  if (mMove.hitCount < MaxMoveHits) {
+                     MoveHit& hit = mMove.hits[mMove.hitCount++];
+                     // The other object may be another item sweeping on
+                     // another thread, its velocity is read in endMove.
+                     hit.objectId = col->getId();
+                     hit.velocity = mVelocity;
                   }
                }
             }
          }
-         else
-         {
-            pos = end;
-            break;
-         }
       }
-      if (count == 3)
+      else
       {
-         // Couldn't move...
-         mVelocity.set(0, 0, 0);
+         pos = end;
+         return true;
       }
    }
 
+   // Couldn't move...
+   mVelocity.set(0, 0, 0);
+   return false;
+}
+
+void StateItem::endMove(const F32 dt)
+{
+   Point3F pos = mMove.pos;
+
+   // Callbacks run by the items that ended their move before us can
+   // delete what we hit, so go by id.
+   for (U32 i = 0; i < mMove.hitCount; i++)
+   {
+      const MoveHit& hit = mMove.hits[i];
+      ShapeBase* object;
+      if (Sim::findObject(hit.objectId, object))
+         queueCollision(object, hit.velocity - object->getVelocity());
+   }
+
    // If on the client, calculate delta for backstepping
    if (isGhost()) {
       delta.pos     = pos;
@@ -2292,9 +3033,9 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
       mPhysicsRep->setTransform( mat );
 
    //
-   if (contact) {
+   if (mMove.contact) {
       // Check for rest condition
-      if (!nonStatic && mVelocity.len() < sAtRestVelocity) {
+      if (!mMove.nonStatic && mVelocity.len() < sAtRestVelocity) {
          mVelocity.x = mVelocity.y = mVelocity.z = 0;
          mAtRest = true;
          mAtRestCounter = 0;
@@ -2302,7 +3043,7 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
 
       // Only update the client if we hit a non-static shape or
       // if this is our final rest pos.
-      if (nonStatic || mAtRest)
+      if (mMove.nonStatic || mAtRest)
          setMaskBits(PositionMask);
    }
 
@@ -2311,7 +3052,7 @@ void StateItem::updatePos(const U32 /*mask*/, const F32 dt)
    if (!isGhost())
    {
       SimObjectPtr<StateItem> safePtr(this);
-      if (stickyNotify)
+      if (mMove.stickyNotify)
       {
          notifyCollision();
          if(bool(safePtr))
@@ -2361,9 +3102,103 @@ bool StateItem::buildPolyList(PolyListContext context, AbstractPolyList* polyLis
 
 //----------------------------------------------------------------------------
 
+StateItem::NetTier StateItem::getNetTier(NetConnection* conn)
+{
+   GameConnection* gameConn = dynamic_cast<GameConnection*>(conn);
+   if (!gameConn)
+      return NearTier;
+
+   GameBase* control = gameConn->getControlObject();
+   if (control && isMounted() && getObjectMount() == control)
+      return HolderTier;
+
+   MatrixF cam;
+   if (!gameConn->getControlCameraTransform(0.0f, &cam))
+      return NearTier;
+
+   VectorF offset = getPosition() - cam.getPosition();
+   F32 distSq = offset.lenSquared();
+   if (distSq < sNetNearDistance * sNetNearDistance)
+      return NearTier;
+
+   F32 visibleDist = sNetNearDistance * sNetVisibleScale;
+   if (distSq < visibleDist * visibleDist && mDot(offset, cam.getForwardVector()) > 0.0f)
+      return NearTier;
+
+   return FarTier;
+}
+
+StateItem::NetConnectionState& StateItem::getNetConnectionState(NetConnection* conn)
+{
+   for (S32 i = mNetConnectionStates.size() - 1; i >= 0; i--)
+   {
+      NetConnectionState& netState = mNetConnectionStates[i];
+      if (netState.conn == conn)
+         return netState;
+
+      // Dropped connections.
+      if (!netState.conn)
+         mNetConnectionStates.erase_fast(i);
+   }
+
+   mNetConnectionStates.increment();
+   NetConnectionState& netState = mNetConnectionStates.last();
+   netState.conn = conn;
+   netState.lastPositionTime = 0;
+   return netState;
+}
+
+// Quantized positions and velocities, see StateItemData::netPositionBits.
+static void writeQuantizedPoint(BitStream* stream, const Point3F& pos, const Box3F& bounds, S32 bits)
+{
+   stream->writeFloat((pos.x - bounds.minExtents.x) / bounds.len_x(), bits);
+   stream->writeFloat((pos.y - bounds.minExtents.y) / bounds.len_y(), bits);
+   stream->writeFloat((pos.z - bounds.minExtents.z) / bounds.len_z(), bits);
+}
+
+static void readQuantizedPoint(BitStream* stream, Point3F* pos, const Box3F& bounds, S32 bits)
+{
+   pos->x = bounds.minExtents.x + stream->readFloat(bits) * bounds.len_x();
+   pos->y = bounds.minExtents.y + stream->readFloat(bits) * bounds.len_y();
+   pos->z = bounds.minExtents.z + stream->readFloat(bits) * bounds.len_z();
+}
+
+static void writeQuantizedVelocity(BitStream* stream, const VectorF& vel, F32 maxVel, S32 bits)
+{
+   stream->writeSignedFloat(mClampF(vel.x / maxVel, -1.0f, 1.0f), bits);
+   stream->writeSignedFloat(mClampF(vel.y / maxVel, -1.0f, 1.0f), bits);
+   stream->writeSignedFloat(mClampF(vel.z / maxVel, -1.0f, 1.0f), bits);
+}
+
+static void readQuantizedVelocity(BitStream* stream, VectorF* vel, F32 maxVel, S32 bits)
+{
+   vel->x = stream->readSignedFloat(bits) * maxVel;
+   vel->y = stream->readSignedFloat(bits) * maxVel;
+   vel->z = stream->readSignedFloat(bits) * maxVel;
+}
+
 U32 StateItem::packUpdate(NetConnection *connection, U32 mask, BitStream *stream)
 {
-   U32 retMask = Parent::packUpdate(connection,mask,stream);
+   // Far clients get our position at a reduced rate, until then the bits
+   // stay dirty for them.  The holder and near clients get every update.
+   U32 deferredMask = 0;
+   NetTier tier = NearTier;
+   if ((mask & PositionMask) && !(mask & InitialUpdateMask))
+   {
+      tier = getNetTier(connection);
+      if (tier == FarTier)
+      {
+         NetConnectionState& netState = getNetConnectionState(connection);
+         SimTime now = Sim::getCurrentTime();
+         if (now - netState.lastPositionTime < (SimTime)getMax(sNetFarPositionInterval, 0))
+            deferredMask = mask & (PositionMask | NoWarpMask);
+         else
+            netState.lastPositionTime = now;
+      }
+   }
+   mask &= ~deferredMask;
+
+   U32 retMask = Parent::packUpdate(connection,mask,stream) | deferredMask;
 
    if (stream->writeFlag(mask & InitialUpdateMask)) {
       stream->writeFlag(mRotate);
@@ -2390,34 +3225,52 @@ U32 StateItem::packUpdate(NetConnection *connection, U32 mask, BitStream *stream
    if (stream->writeFlag(mask & PositionMask)) {
       Point3F pos;
       mObjToWorld.getColumn(3,&pos);
-      mathWrite(*stream, pos);
+      // Far clients get positions relative to their control object.
+      bool coarse = stream->writeFlag(tier == FarTier);
+      if (coarse)
+         stream->writeCompressedPoint(pos, sNetFarPositionPrecision);
+      else if (stream->writeFlag(mDataBlock->netPositionBits && mDataBlock->mNetBounds.isContained(pos)))
+         writeQuantizedPoint(stream, pos, mDataBlock->mNetBounds, mDataBlock->netPositionBits);
+      else
+         mathWrite(*stream, pos);
       if (!stream->writeFlag(mAtRest)) {
-         mathWrite(*stream, mVelocity);
+         if (coarse)
+            stream->writeVector(mVelocity, sNetFarVelocityMin, sNetFarVelocityMax, 10, 9, 8);
+         else if (mDataBlock->netVelocityBits)
+            writeQuantizedVelocity(stream, mVelocity, mDataBlock->maxVelocity, mDataBlock->netVelocityBits);
+         else
+            mathWrite(*stream, mVelocity);
       }
       stream->writeFlag(!(mask & NoWarpMask));
    }
 
    //-JR
    //Advanced StateItem Support 
+   // The inputs only go when one of them changed.  The triggers change
+   // with every shot, the rest rarely, so they are dirtied separately.
+   if(stream->writeFlag(mask & TriggerMask))
+   {
+	  stream->writeFlag(getInput(StateItemData::TriggerInput));
+	  stream->writeFlag(getInput(StateItemData::AltTriggerInput));
+	  stream->writeInt(fireCount(),3);
+   }
+   if(stream->writeFlag(mask & FlagMask))
+   {
+	  stream->writeFlag(getInput(StateItemData::LoadedInput));
+	  stream->writeFlag(getInput(StateItemData::AmmoInput));                    
+	  stream->writeFlag(getInput(StateItemData::TargetInput));                  
+	  stream->writeFlag(getInput(StateItemData::WetInput));
+   }
    if(stream->writeFlag(mask & StateMask))
    {
-	  stream->writeFlag(loaded);
-	  stream->writeFlag(triggerDown);
-	  stream->writeFlag(altTriggerDown);
-	  stream->writeInt(fireCount,3);
-	  stream->writeFlag(ammo);                    
-	  stream->writeFlag(target);                  
-	  stream->writeFlag(wet);
 	  stream->writeInt(mountPoint, 3);
 
 	  //here for now, instead of manualstatemask, because that mask is being a butt-face
-	  S32 st = mDataBlock->lookupState(state->name);
-	  stream->writeInt(st,StateItemData::NumStateBits);
+	  stream->writeInt(getMax(getStateIndex(), 0),StateItemData::NumStateBits);
    }
    if(stream->writeFlag(mask & ManualStateMask))
    {
-	  S32 st = mDataBlock->lookupState(state->name);
-	  stream->writeInt(st,StateItemData::NumStateBits);
+	  stream->writeInt(getMax(getStateIndex(), 0),StateItemData::NumStateBits);
    }
    //-JR
    return retMask;
@@ -2453,10 +3306,20 @@ void StateItem::unpackUpdate(NetConnection *connection, BitStream *stream)
    }*/
    if (stream->readFlag()) {
       Point3F pos;
-      mathRead(*stream, &pos);
+      bool coarse = stream->readFlag();
+      if (coarse)
+         stream->readCompressedPoint(&pos, sNetFarPositionPrecision);
+      else if (stream->readFlag())
+         readQuantizedPoint(stream, &pos, mDataBlock->mNetBounds, mDataBlock->netPositionBits);
+      else
+         mathRead(*stream, &pos);
       F32 speed = mVelocity.len();
       if ((mAtRest = stream->readFlag()) == true)
          mVelocity.set(0.0f, 0.0f, 0.0f);
+      else if (coarse)
+         stream->readVector(&mVelocity, sNetFarVelocityMin, sNetFarVelocityMax, 10, 9, 8);
+      else if (mDataBlock->netVelocityBits)
+         readQuantizedVelocity(stream, &mVelocity, mDataBlock->maxVelocity, mDataBlock->netVelocityBits);
       else
          mathRead(*stream, &mVelocity);
 
@@ -2505,14 +3368,25 @@ void StateItem::unpackUpdate(NetConnection *connection, BitStream *stream)
    //Advanced StateItem Support 
    if(stream->readFlag())
    {
-	  loaded = stream->readFlag();
-	  triggerDown = stream->readFlag();
-	  altTriggerDown = stream->readFlag();
-	  S32 count = stream->readInt(3);
-	  //updateState(0); //not needed as it ticks properly now.
-	  ammo = stream->readFlag();                    
-	  target = stream->readFlag();                  
-	  wet = stream->readFlag();
+	  setInput(StateItemData::TriggerInput, stream->readFlag());
+	  setInput(StateItemData::AltTriggerInput, stream->readFlag());
+	  U32 count = stream->readInt(3);
+
+	  // Ghosts never enter the fire state on their own, a new count
+	  // from the server is what puts them there.
+	  if (isProperlyAdded() && count != mNetFireCount && mDataBlock->fireState != -1)
+		 setState(mDataBlock->fireState, true);
+	  mNetFireCount = count;
+   }
+   if(stream->readFlag())
+   {
+	  setInput(StateItemData::LoadedInput, stream->readFlag());
+	  setInput(StateItemData::AmmoInput, stream->readFlag());                    
+	  setInput(StateItemData::TargetInput, stream->readFlag());                  
+	  setInput(StateItemData::WetInput, stream->readFlag());
+   }
+   if(stream->readFlag())
+   {
 	  mountPoint = stream->readInt(3);
 
 	  //manualstatemask being a buttface, as stated above
@@ -2528,6 +3402,50 @@ void StateItem::unpackUpdate(NetConnection *connection, BitStream *stream)
    Parent::setTransform(mat);
 }
 
+DefineEngineMethod( StateItemData, dumpProfile, bool, ( const char* fileName ), ( "" ),
+   "@brief Dumps the per state counters gathered while $StateItem::profile is set, as CSV.\n\n"
+   "The first table has the time spent in, entries to, callbacks made and time spent in the callbacks of, "
+   "and emitters, sounds and lights started by each state.  The second has the transitions taken between "
+   "each pair of states, in total and per second since the counters were reset.\n\n"
+   "@param fileName File to write, the console if empty.\n"
+   "@return False if the counters aren't built in, or the file can't be written.\n"
+   "@ingroup GameObjects" )
+{
+#ifdef STATEITEM_PROFILE
+   Vector<String> lines;
+   object->getProfileCSV(lines);
+
+   if (!fileName[0])
+   {
+      for (U32 i = 0; i < lines.size(); i++)
+         Con::printf("%s", lines[i].c_str());
+      return true;
+   }
+
+   FileStream stream;
+   if (!stream.open(fileName, Torque::FS::File::Write))
+   {
+      Con::errorf("StateItemData::dumpProfile - unable to write %s", fileName);
+      return false;
+   }
+   for (U32 i = 0; i < lines.size(); i++)
+      stream.writeLine((const U8*)lines[i].c_str());
+   return true;
+#else
+   Con::errorf("StateItemData::dumpProfile - built without STATEITEM_PROFILE");
+   return false;
+#endif
+}
+
+DefineEngineMethod( StateItemData, resetProfile, void, (),,
+   "@brief Zeroes the per state counters, see dumpProfile().\n\n"
+   "@ingroup GameObjects" )
+{
+#ifdef STATEITEM_PROFILE
+   object->resetProfile();
+#endif
+}
+
 DefineEngineMethod( StateItem, isStatic, bool, (),, "@brief Is the object static (ie, non-movable)?\n\n"   
    "@return True if the object is static, false if it is not.\n"
    "@tsexample\n"
@@ -2640,6 +3558,54 @@ void StateItem::consoleInit()
 	   "@ingroup GameObjects");
    Con::addVariable("StateItem::maxWarpTicks",TypeS32,&sMaxWarpTicks, "Max warp duration in ticks.\n"
 	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::parallelThreshold",TypeS32,&StateItemManager::smParallelThreshold,
+      "Number of StateItems at which state transitions are evaluated on the thread pool.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::parallelChunkSize",TypeS32,&StateItemManager::smChunkSize,
+      "StateItems per thread pool work item when evaluating state transitions.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::broadphaseCellSize",TypeF32,&StateItemManager::smBroadphaseCellSize,
+      "Edge length in meters of the cells moving StateItems share collision queries in.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::maxVoices",TypeS32,&StateItemVoicePool::smMaxVoices,
+      "Most StateItem sounds playing at once; past this the least audible one is stopped.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::maxFreeVoices",TypeS32,&StateItemVoicePool::smMaxFreeSources,
+      "Most stopped StateItem sound sources kept around for reuse.\n"
+	   "@ingroup GameObjects");
+#ifdef STATEITEM_PROFILE
+   Con::addVariable("StateItem::profile",TypeBool,&StateItem::smProfile,
+      "Count time, transitions, callbacks and spawns per state in each StateItemData, see StateItemData::dumpProfile().\n"
+	   "@ingroup GameObjects");
+#endif
+   Con::addVariable("StateItem::maxLights",TypeS32,&StateItemLightBudget::smMaxLights,
+      "Most StateItem dynamic lights registered per frame; the ones lighting the most of the screen win.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::maxLightDistance",TypeF32,&StateItemLightBudget::smMaxDistance,
+      "StateItem lights farther than this from the camera, less their radius, are not registered.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::emitterPoolSize",TypeS32,&StateItemEmitterPool::smMaxPerDataBlock,
+      "Most pooled StateItem state emitters per ParticleEmitterData; past this the least recently used one is taken over.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::datablockCache",TypeBool,&StateItemDataCache::smEnabled,
+      "If true, servers send only the hash of a StateItemData's states and clients take them from their cache, "
+      "asking the server on a miss.  If false the states go with every datablock.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::datablockCachePath",TypeString,&StateItemDataCache::smPath,
+      "Directory clients keep cached StateItemData states in.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::netNearDistance",TypeF32,&sNetNearDistance,
+      "Distance in meters within which clients get every StateItem update.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::netVisibleScale",TypeF32,&sNetVisibleScale,
+      "How much further than StateItem::netNearDistance clients get every update of StateItems in front of their camera.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::netFarPositionInterval",TypeS32,&sNetFarPositionInterval,
+      "Milliseconds between StateItem position updates to clients farther away; these also get coarser positions.\n"
+	   "@ingroup GameObjects");
+   Con::addVariable("StateItem::maxCasings",TypeS32,&StateItemCasingSet::smMaxCasings,
+      "Most shell casings kept per casing DebrisData; past this the oldest is reused.  Read when the first casing of a DebrisData is ejected.\n"
+	   "@ingroup GameObjects");
 }
 
 //----------------------------------------------------------------------------
@@ -2650,7 +3616,20 @@ void StateItem::prepRenderImage( SceneRenderState* state )
    if (getDamageState() == Destroyed)
       return;
 
+   if (state->isDiffusePass())
+   {
+      mAnimVisible = true;
+      mAnimCameraDistSq = (getRenderPosition() - state->getDiffuseCameraPosition()).lenSquared();
+
+      // Back in view, catch the threads up before we are drawn.
+      if (mAnimPendingDt > 0.0f && isAnimDue())
+         advanceThreads();
+   }
+
    Parent::prepRenderImage( state );
+
+   // The shape may have been animated for rendering.
+   invalidateRenderTransforms();
 }
 
 void StateItem::buildConvex(const Box3F& box, Convex* convex)
@@ -2717,18 +3696,15 @@ void StateItem::advanceTime(F32 dt)
    }
    else
    {
-	  MatrixF mat;
-	  mMount.object->getRenderMountTransform( dt, mMount.node, mMount.xfm, &mat );
-
-	  //apply offset
-	  mat.mul(mDataBlock->mountOffset);
-
-	  Parent::setTransform(mat);
-	  Parent::setRenderTransform(mat);
+	  // Our mount may not have advanced yet, StateItemManager places
+	  // us once everything has, see updateMountTransform.
+	  StateItemManager::get(false)->markMountsStale(dt);
    }//-JR
 
    //-JR
    updateAnimation(dt);
+   if (!isMounted())
+      updateEmitters(dt);
 }
 
 
@@ -2741,66 +3717,36 @@ StateItemData* StateItem::getPendingStateItem()
 
 bool StateItem::isFiring()
 {
-   return mDataBlock && state->fire;
+   StateItemData::StateData* sd = mDataBlock ? getStateData() : NULL;
+   return sd && sd->fire;
 }
 
 bool StateItem::isAltFiring()
 {
-   return mDataBlock && state->altFire;
+   StateItemData::StateData* sd = mDataBlock ? getStateData() : NULL;
+   return sd && sd->altFire;
 }
 
 bool StateItem::isReloading()
 {
-   return mDataBlock && state->reload;
+   StateItemData::StateData* sd = mDataBlock ? getStateData() : NULL;
+   return sd && sd->reload;
 }
 
 bool StateItem::isReady(U32 ns,U32 depth)
 {
-   // Will pressing the trigger lead to a fire state?
-   if (depth++ > 5 || !mDataBlock)
+   // Will pressing the trigger lead to a fire state?  Precomputed for
+   // every state and input combination, see StateItemData::readyTable.
+   if (!mDataBlock || !mBatch)
       return false;
-   StateItemData::StateData& stateData = (ns == -1) ? *state : mDataBlock->state[ns];
-   if (stateData.fire)
-      return true;
-
-   // Try the transitions...
-   if (stateData.ignoreLoadedForReady == true) {
-      if ((ns = stateData.transition.loaded[true]) != -1)
-         if (isReady(ns,depth))
-            return true;
-   } else {
-      if ((ns = stateData.transition.loaded[loaded]) != -1)
-         if (isReady(ns,depth))
-            return true;
-   }
-   for (U32 i=0; i<StateItemData::MaxGenericTriggers; ++i)
+   if ((S32)ns == -1)
    {
-      if ((ns = stateData.transition.genericTrigger[i][genericTrigger[i]]) != -1)
-         if (isReady(ns,depth))
-            return true;
+      S32 index = getStateIndex();
+      if (index < 0)
+         return false;
+      ns = index;
    }
-   if ((ns = stateData.transition.ammo[ammo]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.target[target]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.wet[wet]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.motion[motion]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.trigger[1]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.altTrigger[1]) != -1)
-      if (isReady(ns,depth))
-         return true;
-   if ((ns = stateData.transition.timeout) != -1)
-      if (isReady(ns,depth))
-         return true;
-   return false;
+   return mDataBlock->lookupReady(ns, depth, getTransitionInputs());
 }
 
 /*bool StateItem::isMounted(StateItemData* imageData)
@@ -2811,23 +3757,94 @@ bool StateItem::isReady(U32 ns,U32 depth)
    return false;
 }
 
-S32 ShapeBase::getMountSlot(StateItemData* imageData)
+S32 ShapeBase::getMountSlot(StateItemData* imageData)
+{
+   for (U32 i = 0; i < MaxMountedImages; i++)
+      if (imageData == mMountedImageList[i].dataBlock)
+         return i;
+   return -1;
+}
+
+NetStringHandle StateItem::getSkinTag()
+{
+   return mDataBlock? skinNameHandle : NetStringHandle();
+}*/
+void StateItem::setInput(U32 bit, bool set)
+{
+   if (!mBatch)
+      return;
+
+   U32 inputs = mBatch->inputs[mBatchSlot];
+   inputs = set ? (inputs | bit) : (inputs & ~bit);
+   if (inputs == mBatch->inputs[mBatchSlot])
+      return;
+
+   mBatch->inputs[mBatchSlot] = inputs;
+   if (isServerObject())
+   {
+      if (bit & csmNetInputs)
+         setMaskBits((bit & (StateItemData::TriggerInput | StateItemData::AltTriggerInput)) ? TriggerMask : FlagMask);
+      StateItemRecorder::recordInput(this, bit, set);
+   }
+   wakeUp();
+}
+
+bool StateItem::queueInput(U32 type, bool value, U32 trigger)
+{
+   if (ThreadManager::isMainThread())
+      return false;
+
+   StateItemManager::InputCommand command;
+   command.id = getId();
+   command.type = type;
+   command.trigger = trigger;
+   command.value = value;
+   StateItemManager::get(isServerObject())->queueInput(command);
+   return true;
+}
+
+bool StateItem::canSleep()
+{
+   if (!mBatch || isMounted() || !(mAtRest || mStatic))
+      return false;
+
+   // On the server a resting item that is neither static nor sticky still
+   // ticks, processTick sets it moving again every csmAtRestTimer ticks in
+   // case what it rests on moved or went away.
+   if (isServerObject() && !mStatic && !mDataBlock->sticky)
+      return false;
+
+   S32 index = getStateIndex();
+   if (index < 0)
+      return true;
+
+   const StateItemData::StateData& stateData = mDataBlock->state[index];
+   if (stateData.transition.timeout != -1)
+      return false;
+
+   // Spinning up or down is driven by the remaining delay.
+   if (delayTime() > 0 && (stateData.spin == StateItemData::StateData::SpinUp ||
+                           stateData.spin == StateItemData::StateData::SpinDown))
+      return false;
+
+   // The flags can't change while we sleep, so neither can this.
+   return mDataBlock->lookupTransition(index, getTransitionInputs()) == -1;
+}
+
+void StateItem::wakeUp()
 {
-   for (U32 i = 0; i < MaxMountedImages; i++)
-      if (imageData == mMountedImageList[i].dataBlock)
-         return i;
-   return -1;
+   if (mSleeping)
+      StateItemManager::get(isServerObject())->wakeItem(this);
 }
 
-NetStringHandle StateItem::getSkinTag()
-{
-   return mDataBlock? skinNameHandle : NetStringHandle();
-}*/
 void StateItem::setGenericTriggerState(U32 trigger, bool state)
 {
-   if (mDataBlock && genericTrigger[trigger] != state) {
-      setMaskBits(StateMask);
-      genericTrigger[trigger] = state;
+   if (queueInput(StateItemManager::GenericTriggerCommand, state, trigger))
+      return;
+
+   U32 bit = StateItemData::GenericTriggerInput << trigger;
+   if (mDataBlock && getInput(bit) != state) {
+      setInput(bit, state);
    }
 }
 
@@ -2835,14 +3852,15 @@ bool StateItem::getGenericTriggerState(U32 trigger)
 {
    if (!mDataBlock)
       return false;
-   return genericTrigger[trigger];
+   return getInput(StateItemData::GenericTriggerInput << trigger);
 }
 
 void StateItem::setAmmoState(bool isAmmo)
 {
-   if (mDataBlock && !mDataBlock->usesEnergy && ammo != isAmmo) {
-      setMaskBits(StateMask);
-      ammo = isAmmo;
+   if (queueInput(StateItemManager::AmmoCommand, isAmmo))
+      return;
+   if (mDataBlock && !mDataBlock->usesEnergy && getInput(StateItemData::AmmoInput) != isAmmo) {
+      setInput(StateItemData::AmmoInput, isAmmo);
    }
 }
 
@@ -2850,15 +3868,15 @@ bool StateItem::getAmmoState()
 {
    if (!mDataBlock)
       return false;
-   return ammo;
+   return getInput(StateItemData::AmmoInput);
 }
 
 void StateItem::setWetState(bool isWet)
 {
-    
-   if (mDataBlock && wet != isWet) {
-      setMaskBits(StateMask);
-      wet = isWet;
+   if (queueInput(StateItemManager::WetCommand, isWet))
+      return;
+   if (mDataBlock && getInput(StateItemData::WetInput) != isWet) {
+      setInput(StateItemData::WetInput, isWet);
    }
 }
 
@@ -2867,45 +3885,51 @@ bool StateItem::getWetState()
     
    if (!mDataBlock)
       return false;
-   return wet;
+   return getInput(StateItemData::WetInput);
 }
 
 void StateItem::setMotionState(bool motion)
 {
-   if (mDataBlock && motion != motion) {
-      setMaskBits(StateMask);
-      motion = motion;
+   if (queueInput(StateItemManager::MotionCommand, motion))
+      return;
+   if (mDataBlock && getInput(StateItemData::MotionInput) != motion) {
+      setInput(StateItemData::MotionInput, motion);
    }
+   // This used to compare motion with itself and never stored it.
+   AssertFatal(!mDataBlock || !mBatch || getMotionState() == motion, "StateItem::setMotionState - motion didn't stick");
 }
 
 bool StateItem::getMotionState()
 {
    if (!mDataBlock)
       return false;
-   return motion;
+   return getInput(StateItemData::MotionInput);
 }
 
 void StateItem::setTargetState(bool target)
 {
-   if (mDataBlock && target != target) {
-      setMaskBits(StateMask);
-      target = target;
+   if (queueInput(StateItemManager::TargetCommand, target))
+      return;
+   if (mDataBlock && getInput(StateItemData::TargetInput) != target) {
+      setInput(StateItemData::TargetInput, target);
    }
+   // This used to compare target with itself and never stored it.
+   AssertFatal(!mDataBlock || !mBatch || getTargetState() == target, "StateItem::setTargetState - target didn't stick");
 }
 
 bool StateItem::getTargetState()
 {
    if (!mDataBlock)
       return false;
-   return target;
+   return getInput(StateItemData::TargetInput);
 }
 
 void StateItem::setLoadedState(bool isloaded)
 {
-    
-   if (mDataBlock && loaded != isloaded) {
-      setMaskBits(StateMask);
-      loaded = isloaded;
+   if (queueInput(StateItemManager::LoadedCommand, isloaded))
+      return;
+   if (mDataBlock && getInput(StateItemData::LoadedInput) != isloaded) {
+      setInput(StateItemData::LoadedInput, isloaded);
    }
 }
 
@@ -2913,7 +3937,7 @@ bool StateItem::getLoadedState()
 {
    if (!mDataBlock)
       return false;
-   return loaded;
+   return getInput(StateItemData::LoadedInput);
 }
 
 void StateItem::getMuzzleVector(VectorF* vec)
@@ -2928,15 +3952,8 @@ void StateItem::getMuzzleVector(VectorF* vec)
 			 if (ShapeBase::getCorrectedAim(mat, vec))
                return;
    }*/
-   GameConnection * gc = getControllingClient();
-   if (gc && !gc->isAIControlled())
-   {
-      bool fp = gc->isFirstPerson();
-      if ((fp && mDataBlock->correctMuzzleVector) ||
-         (!fp && mDataBlock->correctMuzzleVectorTP))
-         if (getCorrectedAim(mat, vec))
-            return;
-   }
+   if (usesCorrectedAim() && getCorrectedAim(mat, vec))
+      return;
 
    mat.getColumn(1,vec);
 }
@@ -2960,15 +3977,8 @@ void StateItem::getRenderMuzzleVector(VectorF* vec)
          if (gc->isFirstPerson() && !gc->isAIControlled())
             if (getCorrectedAim(mat, vec))
                return;*/
-   GameConnection * gc = getControllingClient();
-   if (gc && !gc->isAIControlled())
-   {
-      bool fp = gc->isFirstPerson();
-      if ((fp && mDataBlock->correctMuzzleVector) ||
-         (!fp && mDataBlock->correctMuzzleVectorTP))
-         if (getCorrectedAim(mat, vec))
-            return;
-   }
+   if (usesCorrectedAim() && getCorrectedAim(mat, vec))
+      return;
 
    mat.getColumn(1,vec);
 }
@@ -2982,13 +3992,21 @@ void StateItem::getRenderMuzzlePoint(Point3F* pos)
 
 //----------------------------------------------------------------------------
 
-void StateItem::scriptCallback(const char* function)
+void StateItem::scriptCallback(U32 stateIdx)
 {
-   char buff1[32];
-   dSprintf( buff1, 32, "%f", mDataBlock->useRemainderDT ? remainingDt : 0.0f );
-
-				  //datablock		    //us		  //owner
-   Con::executef( mDataBlock, function, getIdString(), mMount.object->getIdString());
+#ifdef STATEITEM_PROFILE
+   if (smProfile)
+   {
+      // The callback may delete us or change our datablock.
+      StateItemData* dataBlock = mDataBlock;
+      S32 start = getProfileTimer()->getElapsedMs();
+      dataBlock->invokeStateCallback(stateIdx, this);
+      dataBlock->profile[stateIdx].callbacks++;
+      dataBlock->profile[stateIdx].callbackMs += getProfileTimer()->getElapsedMs() - start;
+      return;
+   }
+#endif
+   mDataBlock->invokeStateCallback(stateIdx, this);
 }
 
 
@@ -3159,10 +4177,46 @@ void StateItem::getRenderMountTransform( F32 delta, S32 mountPoint, const Matrix
 }
 
 
+bool StateItem::findCachedTransform(S32 node, MatrixF* mat) const
+{
+   for (U32 i = 0; i < MaxCachedTransforms; i++)
+   {
+      const CachedTransform& entry = mTransformCache[i];
+      if (entry.node == node && entry.generation == mRenderGeneration)
+      {
+         *mat = entry.mat;
+         return true;
+      }
+   }
+   return false;
+}
+
+void StateItem::cacheTransform(S32 node, const MatrixF& mat)
+{
+   // Reuse the node's entry or a stale one before evicting.
+   S32 slot = -1;
+   for (U32 i = 0; i < MaxCachedTransforms && slot == -1; i++)
+      if (mTransformCache[i].node == node || mTransformCache[i].generation != mRenderGeneration)
+         slot = i;
+   if (slot == -1)
+   {
+      slot = mTransformCacheNext;
+      mTransformCacheNext = (mTransformCacheNext + 1) % MaxCachedTransforms;
+   }
+
+   CachedTransform& entry = mTransformCache[slot];
+   entry.node = node;
+   entry.generation = mRenderGeneration;
+   entry.mat = mat;
+}
+
 void StateItem::getRenderStateItemTransform(MatrixF* mat, bool noEyeOffset )
 {
    // Image transform in world space
     
+   if (!noEyeOffset && findCachedTransform(-1, mat))
+      return;
+
    if (mDataBlock) 
    {
       StateItemData& data = *mDataBlock;
@@ -3189,6 +4243,9 @@ void StateItem::getRenderStateItemTransform(MatrixF* mat, bool noEyeOffset )
    }
    else
       *mat = getRenderTransform();
+
+   if (!noEyeOffset)
+      cacheTransform(-1, *mat);
 }
 
 void StateItem::getRenderStateItemTransform(S32 node,MatrixF* mat)
@@ -3204,6 +4261,9 @@ void StateItem::getRenderStateItemTransform(S32 node,MatrixF* mat)
    {
       if (node != -1)
       {
+         if (findCachedTransform(node, mat))
+            return;
+
          StateItemData& data = *mDataBlock;
 
          MatrixF nmat = mShapeInstance->mNodeTransforms[node];
@@ -3233,6 +4293,7 @@ void StateItem::getRenderStateItemTransform(S32 node,MatrixF* mat)
          }
 
          mat->mul(mmat, nmat);
+         cacheTransform(node, *mat);
       }
       else
          getRenderStateItemTransform(mat);
@@ -3298,17 +4359,22 @@ S32 StateItem::getNodeIndex(StringTableEntry nodeName)
       return -1;
 }
 
-// Modify muzzle if needed to aim at whatever is straight in front of eye.  Let the
-// caller know if we actually modified the result.
-bool StateItem::getCorrectedAim(const MatrixF& muzzleMat, VectorF* result)
+bool StateItem::usesCorrectedAim()
+{
+   GameConnection * gc = getControllingClient();
+   if (!gc || gc->isAIControlled())
+      return false;
+
+   return gc->isFirstPerson() ? mDataBlock->correctMuzzleVector : mDataBlock->correctMuzzleVectorTP;
+}
+
+void StateItem::getAimRay(Point3F* start, Point3F* end)
 {
-   const F32 pullInD = sFullCorrectionDistance;
    const F32 maxAdjD = 500;
 
    VectorF  aheadVec(0, maxAdjD, 0);
 
    MatrixF  camMat;
-   Point3F  camPos;
 
    F32 pos = 0;
    GameConnection * gc = getControllingClient();
@@ -3317,24 +4383,34 @@ bool StateItem::getCorrectedAim(const MatrixF& muzzleMat, VectorF* result)
 
    getCameraTransform(&pos, &camMat);
 
-   camMat.getColumn(3, &camPos);
+   camMat.getColumn(3, start);
    camMat.mulV(aheadVec);
-   Point3F  aheadPoint = (camPos + aheadVec);
+   *end = *start + aheadVec;
+}
+
+// Modify muzzle if needed to aim at whatever is straight in front of eye.  Let the
+// caller know if we actually modified the result.
+bool StateItem::getCorrectedAim(const MatrixF& muzzleMat, VectorF* result)
+{
+   const F32 pullInD = sFullCorrectionDistance;
+
+   Point3F  camPos;
+   Point3F  aheadPoint;
+   getAimRay(&camPos, &aheadPoint);
 
    // Should we check if muzzle point is really close to camera?  Does that happen?
    Point3F  muzzlePos;
    muzzleMat.getColumn(3, &muzzlePos);
 
+   // The trace is shared with anything else aiming from this camera this tick.
    Point3F  collidePoint;
    VectorF  collideVector;
-   disableCollision();
-      RayInfo rinfo;
-      if (getContainer()->castRay(camPos, aheadPoint, STATIC_COLLISION_TYPEMASK|DAMAGEABLE_TYPEMASK, &rinfo) &&
-         (mDot(rinfo.point - mObjToWorld.getPosition(), mObjToWorld.getForwardVector()) > 0)) // Check if point is behind us (could happen in 3rd person view)
-         collideVector = ((collidePoint = rinfo.point) - camPos);
-      else
-         collideVector = ((collidePoint = aheadPoint) - camPos);
-   enableCollision();
+   Point3F  hitPoint;
+   if (StateItemManager::get(isServerObject())->traceAimRay(this, camPos, aheadPoint, &hitPoint) &&
+      (mDot(hitPoint - mObjToWorld.getPosition(), mObjToWorld.getForwardVector()) > 0)) // Check if point is behind us (could happen in 3rd person view)
+      collideVector = ((collidePoint = hitPoint) - camPos);
+   else
+      collideVector = ((collidePoint = aheadPoint) - camPos);
 
    // For close collision we want to NOT aim at ground since we're bending
    // the ray here as it is.  But we don't want to pop, so adjust continuously.
@@ -3584,64 +4660,42 @@ bool StateItem::getTriggerState()
 {
    if (isGhost() || !mDataBlock)
       return false;
-   return triggerDown;
+   return getInput(StateItemData::TriggerInput);
 }
 
 void StateItem::setTriggerState(bool trigger)
 {
-   if (isGhost() || !mDataBlock)
+   if (isGhost() || queueInput(StateItemManager::TriggerCommand, trigger))
+      return;
+   if (!mDataBlock)
       return;
     
 
-   if (trigger) {
-      if (!triggerDown && mDataBlock) {
-         triggerDown = true;
-         if (!isGhost()) {
-            setMaskBits(StateMask);
-            updateState(0);
-         }
-      }
+   if (trigger != getInput(StateItemData::TriggerInput)) {
+      setInput(StateItemData::TriggerInput, trigger);
+      updateState(0);
    }
-   else
-      if (triggerDown) {
-         triggerDown = false;
-         if (!isGhost()) {
-            setMaskBits(StateMask);
-            updateState(0);
-         }
-      }
 }
 
 bool StateItem::getAltTriggerState()
 {
    if (isGhost() || !mDataBlock)
       return false;
-   return altTriggerDown;
+   return getInput(StateItemData::AltTriggerInput);
 }
 
 void StateItem::setAltTriggerState(bool trigger)
 {
-   if (isGhost() || !mDataBlock)
+   if (isGhost() || queueInput(StateItemManager::AltTriggerCommand, trigger))
+      return;
+   if (!mDataBlock)
       return;
     
 
-   if (trigger) {
-      if (!altTriggerDown && mDataBlock) {
-         altTriggerDown = true;
-         if (!isGhost()) {
-            setMaskBits(StateMask);
-            updateState(0);
-         }
-      }
+   if (trigger != getInput(StateItemData::AltTriggerInput)) {
+      setInput(StateItemData::AltTriggerInput, trigger);
+      updateState(0);
    }
-   else
-      if (altTriggerDown) {
-         altTriggerDown = false;
-         if (!isGhost()) {
-            setMaskBits(StateMask);
-            updateState(0);
-         }
-      }
 }
 
 //----------------------------------------------------------------------------
@@ -3677,22 +4731,20 @@ bool StateItem::hasState(const char* state)
       return false;
 
    if (mDataBlock)
-   {
-      for (U32 i = 0; i < StateItemData::MaxStates; i++)
-      {
-         StateItemData::StateData& sd = mDataBlock->state[i];
-         if (sd.name && !dStricmp(state, sd.name))
-            return true;
-      }
-   }
+      return mDataBlock->findState(state) != -1;
 
    return false;
 }
 
 void StateItem::setState(U32 newState,bool force)
 {
-   if (!mDataBlock)
+   if (!mDataBlock || !mBatch)
       return;
+
+   // The new state may have a timeout to run down.
+   wakeUp();
+
+   StateItemData::StateData* state = getStateData();
     
    // The client never enters the initial fire state on its own, but it
    //  will continue to set that state...
@@ -3722,16 +4774,40 @@ void StateItem::setState(U32 newState,bool force)
    }
 
 
-   // Server must animate the shape if it is a firestate...
-   if (isServerObject() && (newState == mDataBlock->fireState  || mDataBlock->state[newState].altFire))
+   // Server must animate the shape if it is a firestate, unless the
+   // root pose will do, see StateItemData::animateOnServer.
+   if (isServerObject() && mDataBlock->animateOnServer &&
+       (newState == mDataBlock->fireState  || mDataBlock->state[newState].altFire))
       mShapeInstance->animate();
 
+   // Threads are about to be reset, they shouldn't get time saved up for
+   // the old state.
+   if (isGhost())
+   {
+      advanceThreads();
+      invalidateRenderTransforms();
+   }
+
+#ifdef STATEITEM_PROFILE
+   if (isServerObject())
+   {
+      // Track entry times even when off, so turning it on counts right.
+      SimTime now = Sim::getCurrentTime();
+      if (smProfile)
+      {
+         SimTime enter = getMax(mProfileStateEnter, mDataBlock->profileStart);
+         mDataBlock->profileTransition(state ? state - mDataBlock->state : -1, newState, now - enter);
+      }
+      mProfileStateEnter = now;
+   }
+#endif
+
    // If going back into the same state, just reset the timer
    // and invoke the script callback
    if (!force && state == &mDataBlock->state[newState]) {
-      delayTime = state->timeoutValue;
+      delayTime() = state->timeoutValue;
       if (state->script && !isGhost())
-         scriptCallback(state->script);
+         scriptCallback(newState);
 
       // If this is a flash sequence, we need to select a new position for the
       //  animation if we're returning to that state...
@@ -3746,15 +4822,17 @@ void StateItem::setState(U32 newState,bool force)
       return;
    }
 
-   F32 lastDelay = delayTime;
+   F32 lastDelay = delayTime();
+   // NULL when entering the first state, or the first after the states
+   // arrived from the server.
    StateItemData::StateData* lastState = state;
-   state = &mDataBlock->state[newState];
+   mBatch->stateIndex[mBatchSlot] = newState;
 
    //
    // Do state cleanup first...
    //
-   StateItemData::StateData& stateData = *state;
-   delayTime = stateData.timeoutValue;
+   StateItemData::StateData& stateData = mDataBlock->state[newState];
+   delayTime() = stateData.timeoutValue;
 
    // Mount pending images
    //not needed here, as i can see
@@ -3776,7 +4854,7 @@ void StateItem::setState(U32 newState,bool force)
    // Reset cyclic sequences back to the first frame to turn it off
    // (the first key frame should be it's off state).
    //if (animThread && animThread->getSequence()->isCyclic()) {
-   if (animThread && animThread->getSequence()->isCyclic() && (stateData.sequenceNeverTransition || !(stateData.sequenceTransitionIn || lastState->sequenceTransitionOut))) {
+   if (animThread && animThread->getSequence()->isCyclic() && (stateData.sequenceNeverTransition || !(stateData.sequenceTransitionIn || (lastState && lastState->sequenceTransitionOut)))) {
       mShapeInstance->setPos(animThread,0);
       mShapeInstance->setTimeScale(animThread,0);
    }
@@ -3791,44 +4869,12 @@ void StateItem::setState(U32 newState,bool force)
    // Check for immediate transitions, but only if we don't need to wait for
    // a time out.  Only perform this wait if we're not forced to change.
    S32 ns;
-   if (delayTime <= 0 || !stateData.waitForTimeout) 
+   if (delayTime() <= 0 || !stateData.waitForTimeout) 
    {
-	   if ((ns = stateData.transition.loaded[loaded]) != -1) {
-		  setState(ns);
-		  return;
-	   }
-	   for (U32 i=0; i<StateItemData::MaxGenericTriggers; ++i)
-       {
-         if ((ns = stateData.transition.genericTrigger[i][genericTrigger[i]]) != -1) {
-            setState( ns);
-            return;
-         }
-       }
-	   //if (!imageData.usesEnergy)
-		  if ((ns = stateData.transition.ammo[ammo]) != -1) {
-			 setState(ns);
-			 return;
-		  }
-	   if ((ns = stateData.transition.target[target]) != -1) {
-		  setState( ns);
-		  return;
-	   }
-	   if ((ns = stateData.transition.wet[wet]) != -1) {
-		  setState( ns);
-		  return;
-	   }
-	   if ((ns = stateData.transition.motion[motion]) != -1) {
-         setState( ns);
+      if ((ns = mDataBlock->lookupTransition(newState, getTransitionInputs())) != -1) {
+         setState(ns);
          return;
       }
-	   if ((ns = stateData.transition.trigger[triggerDown]) != -1) {
-		  setState(ns);
-		  return;
-	   }
-	   if ((ns = stateData.transition.altTrigger[altTriggerDown]) != -1) {
-		  setState(ns);
-		  return;
-	   }
    }
 
    //
@@ -3836,10 +4882,10 @@ void StateItem::setState(U32 newState,bool force)
    //
    //delayTime = stateData.timeoutValue;
    if (stateData.loaded != StateItemData::StateData::IgnoreLoaded)
-      loaded = stateData.loaded == StateItemData::StateData::Loaded;
+      setInput(StateItemData::LoadedInput, stateData.loaded == StateItemData::StateData::Loaded);
    if (!isGhost() && newState == mDataBlock->fireState) {
-      setMaskBits(StateMask);
-      fireCount = (fireCount + 1) & 0x7;
+      setMaskBits(TriggerMask);
+      fireCount() = (fireCount() + 1) & 0x7;
    }
    if (!isGhost() && mDataBlock->state[newState].altFire) {
       setMaskBits(StateMask);
@@ -3861,19 +4907,14 @@ void StateItem::setState(U32 newState,bool force)
    }
 
    // Delete any loooping sounds that were in the previous state.
-   if (lastState->sound && lastState->sound->getDescription()->mIsLooping)  
-   {  
-      for(Vector<SFXSource*>::iterator i = mSoundSources.begin(); i != mSoundSources.end(); i++)      
-         SFX_DELETE((*i));    
-
-      mSoundSources.clear();  
-   }
+   if (lastState && lastState->sound && lastState->sound->getDescription()->mIsLooping && isGhost())
+      StateItemVoicePool::get()->stopOwner(this);
 
    // Play sound
    if( stateData.sound && isGhost() )
    {
-      const Point3F& velocity = getVelocity();
-	   addSoundSource(SFX->createSource( stateData.sound, &getRenderTransform(), &velocity )); 
+      addSoundSource(stateData.sound);
+      STATEITEM_PROFILE_SPAWN(this, SoundSpawn);
    }
 
    // Play animation
@@ -3901,7 +4942,10 @@ void StateItem::setState(U32 newState,bool force)
 
    // Start particle emitter on the client
    if (isGhost() && stateData.emitter)
+   {
       startStateItemEmitter(stateData);
+      STATEITEM_PROFILE_SPAWN(this, EmitterSpawn);
+   }
 
    // Start spin thread
    if (spinThread) {
@@ -3913,12 +4957,12 @@ void StateItem::setState(U32 newState,bool force)
          mShapeInstance->setTimeScale(spinThread,0);
          break;
        case StateItemData::StateData::SpinUp:
-         if (lastState->spin == StateItemData::StateData::SpinDown)
-            delayTime *= 1.0f - (lastDelay / stateData.timeoutValue);
+         if (lastState && lastState->spin == StateItemData::StateData::SpinDown)
+            delayTime() *= 1.0f - (lastDelay / stateData.timeoutValue);
          break;
        case StateItemData::StateData::SpinDown:
-         if (lastState->spin == StateItemData::StateData::SpinUp)
-            delayTime *= 1.0f - (lastDelay / stateData.timeoutValue);
+         if (lastState && lastState->spin == StateItemData::StateData::SpinUp)
+            delayTime() *= 1.0f - (lastDelay / stateData.timeoutValue);
          break;
        case StateItemData::StateData::FullSpin:
          mShapeInstance->setTimeScale(spinThread,1);
@@ -3928,11 +4972,11 @@ void StateItem::setState(U32 newState,bool force)
 
    // Script callback on server
    if (stateData.script && stateData.script[0] && !isGhost())
-      scriptCallback(stateData.script);
+      scriptCallback(newState);
 
    // If there is a zero timeout, and a timeout transition, then
    // go ahead and transition imediately.
-   if (!delayTime)
+   if (!delayTime())
    {
       if ((ns = stateData.transition.timeout) != -1)
       {
@@ -3944,7 +4988,7 @@ void StateItem::setState(U32 newState,bool force)
 
 void StateItem::updateAnimThread(StateItemData::StateData* lastState)
 {
-   StateItemData::StateData& stateData = *state;
+   StateItemData::StateData& stateData = *getStateData();
 
    F32 randomPos = Platform::getRandom();
 
@@ -4105,28 +5149,28 @@ void StateItem::updateAnimThread(StateItemData::StateData* lastState)
 
 void StateItem::updateState(F32 dt)
 {
-   if (!mDataBlock)
+   if (!mDataBlock || !mBatch)
       return;
 
-   if(!state)
+   if(getStateIndex() < 0)
       return;
 
-   remainingDt = dt;
+   remainingDt() = dt;
    F32 elapsed;
 
 TICKAGAIN:
 
-   StateItemData::StateData& stateData = *state;
+   StateItemData::StateData& stateData = *getStateData();
 
-   if ( delayTime > dt )
+   if ( delayTime() > dt )
       elapsed = dt;
    else
-      elapsed = delayTime;
+      elapsed = delayTime();
 
    dt = elapsed;
-   remainingDt -= elapsed;
+   remainingDt() -= elapsed;
 
-   delayTime -= dt;
+   delayTime() -= dt;
 
    // Energy management
    if (mDataBlock->usesEnergy) 
@@ -4149,80 +5193,80 @@ TICKAGAIN:
 
    // Check for transitions. On some states we must wait for the
    // full timeout value before moving on.
-   if (delayTime <= 0 || !stateData.waitForTimeout) 
+   if (delayTime() <= 0 || !stateData.waitForTimeout) 
    {
-      S32 ns;
+      S32 ns = mDataBlock->lookupTransition(getStateIndex(), getTransitionInputs());
 
-	  if ((ns = stateData.transition.loaded[loaded]) != -1) 
-         setState(ns);
-	  else if ((ns = stateData.transition.genericTrigger[0][genericTrigger[0]]) != -1)
+      if (ns != -1)
          setState(ns);
-      else if ((ns = stateData.transition.genericTrigger[1][genericTrigger[1]]) != -1)
-         setState(ns);
-      else if ((ns = stateData.transition.genericTrigger[2][genericTrigger[2]]) != -1)
-         setState(ns);
-      else if ((ns = stateData.transition.genericTrigger[3][genericTrigger[3]]) != -1)
-         setState(ns);
-      else if ((ns = stateData.transition.ammo[ammo]) != -1)  
-         setState(ns);
-      else if ((ns = stateData.transition.target[target]) != -1) 
-         setState(ns);
-      else if ((ns = stateData.transition.wet[wet]) != -1) 
-         setState(ns);
-	  else if ((ns = stateData.transition.motion[motion]) != -1)
-         setState(ns);
-      else if ((ns = stateData.transition.trigger[triggerDown]) != -1) 
-         setState(ns);
-      else if ((ns = stateData.transition.altTrigger[altTriggerDown]) != -1) 
-         setState(ns);
-      else if (delayTime <= 0 && (ns = stateData.transition.timeout) != -1)  
+      else if (delayTime() <= 0 && (ns = stateData.transition.timeout) != -1)
          setState(ns);
    }
 
    // Update the spinning thread timeScale
-   if (spinThread) 
-   {
-	  float timeScale;
+   updateSpinThread(stateData);
 
-	  switch (stateData.spin) 
-	  {
-		 case StateItemData::StateData::IgnoreSpin:
-		 case StateItemData::StateData::NoSpin:
-		 case StateItemData::StateData::FullSpin: 
-		 {
-			timeScale = 0;
-			mShapeInstance->setTimeScale(spinThread, mShapeInstance->getTimeScale(spinThread));
-			break;
-		 }
+   if ( remainingDt() > 0.0f && delayTime() > 0.0f && mDataBlock->useRemainderDT && dt != 0.0f )
+      goto TICKAGAIN;
+}
 
-		 case StateItemData::StateData::SpinUp: 
-		 {
-			timeScale = 1.0f - delayTime / stateData.timeoutValue;
-			mShapeInstance->setTimeScale(spinThread,timeScale);
-			break;
-		 }
+void StateItem::updateSpinThread(const StateItemData::StateData& stateData)
+{
+   if (!spinThread) 
+      return;
 
-		 case StateItemData::StateData::SpinDown: 
-		 {
-			timeScale = delayTime / stateData.timeoutValue;
-			mShapeInstance->setTimeScale(spinThread,timeScale);
-			break;
-		 }
-	  }
-   }
+   float timeScale;
 
-   if ( remainingDt > 0.0f && delayTime > 0.0f && mDataBlock->useRemainderDT && dt != 0.0f )
-      goto TICKAGAIN;
+   switch (stateData.spin) 
+   {
+      case StateItemData::StateData::IgnoreSpin:
+      case StateItemData::StateData::NoSpin:
+      case StateItemData::StateData::FullSpin: 
+      {
+         timeScale = 0;
+         mShapeInstance->setTimeScale(spinThread, mShapeInstance->getTimeScale(spinThread));
+         break;
+      }
+
+      case StateItemData::StateData::SpinUp: 
+      {
+         timeScale = 1.0f - delayTime() / stateData.timeoutValue;
+         mShapeInstance->setTimeScale(spinThread,timeScale);
+         break;
+      }
+
+      case StateItemData::StateData::SpinDown: 
+      {
+         timeScale = delayTime() / stateData.timeoutValue;
+         mShapeInstance->setTimeScale(spinThread,timeScale);
+         break;
+      }
+   }
 }
 
 
+U32 StateItem::getTransitionInputs() const
+{
+   return mBatch ? mBatch->inputs[mBatchSlot] : 0;
+}
+
 //----------------------------------------------------------------------------
 
-void StateItem::updateAnimation(F32 dt)
+bool StateItem::isAnimDue() const
 {
-   //if (!mMountedImageList[imageSlot].dataBlock)
-   //   return;
-    
+   F32 lodDist = mDataBlock->animLODDistance;
+   if (lodDist <= 0.0f || mAnimCameraDistSq <= lodDist * lodDist)
+      return true;
+   return mAnimPendingDt >= mDataBlock->animLODInterval;
+}
+
+void StateItem::advanceThreads()
+{
+   F32 dt = mAnimPendingDt;
+   mAnimPendingDt = 0.0f;
+   if (dt <= 0.0f)
+      return;
+
    // Advance animation threads
    if (ambientThread)
       mShapeInstance->advanceTime(dt,ambientThread);
@@ -4233,11 +5277,28 @@ void StateItem::updateAnimation(F32 dt)
    if (flashThread)
       mShapeInstance->advanceTime(dt,flashThread);
 
+   invalidateRenderTransforms();
+
    // Broadcast the update
    onStateItemAnimThreadUpdate(dt);
+}
 
-   updateSoundSources(getRenderTransform());
+void StateItem::updateAnimation(F32 dt)
+{
+   //if (!mMountedImageList[imageSlot].dataBlock)
+   //   return;
+    
+   // Off screen and far away items save their thread time up,
+   // see StateItemData::animCullOffscreen.
+   mAnimPendingDt += dt;
+   bool visible = mAnimVisible || !mDataBlock->animCullOffscreen;
+   mAnimVisible = false;
+   if (visible && isAnimDue())
+      advanceThreads();
+}
 
+void StateItem::updateEmitters(F32 dt)
+{
    // Particle emission
    for (S32 i = 0; i < MaxImageEmitters; i++) {
       StateItemEmitter& em = emitter[i];
@@ -4250,10 +5311,11 @@ void StateItem::updateAnimation(F32 dt)
             Point3F pos,axis;
             mat.getColumn(3,&pos);
             mat.getColumn(1,&axis);
-            em.emitter->emitParticles(pos,true,axis,getVelocity(),(U32) (dt * 1000));
+            em.emitter->emitParticles(pos,!em.restart,axis,getVelocity(),(U32) (dt * 1000));
+            em.restart = false;
          }
          else {
-            em.emitter->deleteWhenEmpty();
+            StateItemEmitterPool::get()->release(em.emitter);
             em.emitter = 0;
          }
       }
@@ -4290,6 +5352,7 @@ void StateItem::startStateItemEmitter(StateItemData::StateData& state)
          if (state.emitter == em->emitter->getDataBlock() && state.emitterNode == em->node) {
             if (state.emitterTime > em->time)
                em->time = state.emitterTime;
+            StateItemEmitterPool::get()->touch(em->emitter);
             return;
          }
          if (!bem || (bool(bem->emitter) && bem->time > em->time))
@@ -4299,14 +5362,46 @@ void StateItem::startStateItemEmitter(StateItemData::StateData& state)
          bem = em;
    }
 
+   if (bool(bem->emitter))
+      StateItemEmitterPool::get()->release(bem->emitter);
+
    bem->time = state.emitterTime;
    bem->node = state.emitterNode;
-   bem->emitter = new ParticleEmitter;
-   bem->emitter->onNewDataBlock(state.emitter,false);
-   if( !bem->emitter->registerObject() )
+   bem->restart = true;
+   bem->emitter = StateItemEmitterPool::get()->acquire(this, state.emitter);
+}
+
+void StateItem::onEmitterStolen(ParticleEmitter* stolen)
+{
+   for (S32 i = 0; i < MaxImageEmitters; i++)
+      if (emitter[i].emitter == stolen)
+         emitter[i].emitter = NULL;
+}
+
+F32 StateItem::getLightIntensity() const
+{
+   switch ( mDataBlock->lightType )
    {
-      bem->emitter.getPointer()->destroySelf();
-      bem->emitter = NULL;
+   case StateItemData::ConstantLight:
+   case StateItemData::SpotLight:
+      return 1.0f;
+
+   case StateItemData::PulsingLight:
+      {
+      F32 intensity = 0.5f + 0.5f * mSin( M_PI_F * (F32)Sim::getCurrentTime() / (F32)mDataBlock->lightDuration + lightStart );
+      return 0.15f + intensity * 0.85f;
+      }
+
+   case StateItemData::WeaponFireLight:
+      {
+      S32 elapsed = Sim::getCurrentTime() - lightStart;
+      if ( elapsed > mDataBlock->lightDuration )
+         return 0.0f;
+      return ( 1.0 - (F32)elapsed / (F32)mDataBlock->lightDuration ) * mDataBlock->lightBrightness;
+      }
+
+   default:
+      return 0.0f;
    }
 }
 
@@ -4315,36 +5410,12 @@ void StateItem::submitLights( LightManager *lm, bool staticLighting )
    if ( staticLighting )
       return;
 
-  //StateItemData *imageData = getMountedImage( i );
-
-  if ( mDataBlock->lightType != StateItemData::NoLight )
+  // The StateItemLightBudget decides who gets a light this frame.
+  if ( mLightAdmitted )
   {                  
-     F32 intensity;
-
-     switch ( mDataBlock->lightType )
-     {
-     case StateItemData::ConstantLight:
-     case StateItemData::SpotLight:
-        intensity = 1.0f;
-        break;
-
-     case StateItemData::PulsingLight:
-        intensity = 0.5f + 0.5f * mSin( M_PI_F * (F32)Sim::getCurrentTime() / (F32)mDataBlock->lightDuration + lightStart );
-        intensity = 0.15f + intensity * 0.85f;
-        break;
-
-     case StateItemData::WeaponFireLight:
-        {
-        S32 elapsed = Sim::getCurrentTime() - lightStart;
-        if ( elapsed > mDataBlock->lightDuration )
-           return;
-        intensity = ( 1.0 - (F32)elapsed / (F32)mDataBlock->lightDuration ) * mDataBlock->lightBrightness;
-        break;
-        }
-     default:
-        intensity = 1.0f;
+     F32 intensity = getLightIntensity();
+     if ( intensity <= 0.0f )
         return;
-     }
 
      if ( !mLight )
         mLight = LightManager::createLightInfo();
@@ -4406,48 +5477,14 @@ void StateItem::ejectShellCasing()
    Point3F shellVel = randomDir * imageData->shellVelocity;
    Point3F shellPos = ejectTrans.getPosition();
 
-
-   Debris *casing = new Debris;
-   casing->onNewDataBlock( imageData->casing, false );
-   casing->setTransform( imageTrans );
-
-   if (!casing->registerObject())
-      delete casing;
-
-   casing->init( shellPos, shellVel );
-}
-
-void StateItem::addSoundSource(SFXSource* source)
-{
-   if(source != NULL)
-   {
-      if(mDataBlock->maxConcurrentSounds > 0 && mSoundSources.size() > mDataBlock->maxConcurrentSounds)
-      {
-         SFX_DELETE(mSoundSources.first());
-         mSoundSources.pop_front();
-      }
-      source->play();
-      mSoundSources.push_back(source);
-   }
+   StateItemCasingSet* casings = StateItemCasingSet::get( imageData->casing );
+   if (casings)
+      casings->eject( imageTrans, shellPos, shellVel );
 }
 
-void StateItem::updateSoundSources( const MatrixF& renderTransform )
+void StateItem::addSoundSource(SFXTrack* track)
 {
-   //iterate through sources. if any of them have stopped playing, delete them.
-   //otherwise, update the transform
-   for (Vector<SFXSource*>::iterator i = mSoundSources.begin(); i != mSoundSources.end(); i++)
-   {
-      if((*i)->isStopped())
-      {
-         SFX_DELETE((*i));
-         mSoundSources.erase(i);
-         i--;
-      }
-      else
-      {
-         (*i)->setTransform(renderTransform);
-      }
-   }
+   StateItemVoicePool::get()->play(this, track, getRenderTransform(), getVelocity(), mDataBlock->maxConcurrentSounds);
 }
 
 ConsoleMethod(StateItem,setTrigger,void,3,3,"%StateItem.setTrigger(bool down)")
@@ -4470,16 +5507,20 @@ ConsoleMethod(StateItem,getAltTrigger,bool,2,2,"%altTriggerDown = %StateItem.get
    return object->getAltTriggerState();
 }
 
+ConsoleMethod(StateItem,isReady,bool,2,2,"%canFire = %StateItem.isReady();")
+{
+   return object->isReady();
+}
+
 void StateItem::setTrigger(bool trigger,bool alt)
 {
+   if (queueInput(alt ? StateItemManager::AltTriggerCommand : StateItemManager::TriggerCommand, trigger))
+      return;
+
    if(isServerObject())
    {
-      if(alt)
-         altTriggerDown = trigger;
-      else
-         triggerDown = trigger;
+      setInput(alt ? StateItemData::AltTriggerInput : StateItemData::TriggerInput, trigger);
 
-      setMaskBits(StateMask);
       updateState(0);
    }
 }
@@ -4523,8 +5564,18 @@ ConsoleMethod( StateItem, setTarget, void, 3, 3, "(bool hasTarget)")
 
 void StateItem::setTarget(bool hasTarget)
 {
-	target = hasTarget;
+	setInput(StateItemData::TargetInput, hasTarget);
+}
+ConsoleMethod( StateItem, getMotion, bool, 2, 2, "()")
+{
+    return object->getMotionState();
 }
+
+ConsoleMethod( StateItem, setMotion, void, 3, 3, "(bool inMotion)")
+{
+	object->setMotionState(dAtob(argv[2]));
+}
+
 ConsoleMethod( StateItem, getWet, bool, 2, 2, "()")
 {
     return object->getWetState();
@@ -15,8 +15,42 @@
 #ifndef _DYNAMIC_CONSOLETYPES_H_
    #include "console/dynamicTypes.h"
 #endif
+#ifndef _TDICTIONARY_H_
+   #include "core/util/tDictionary.h"
+#endif
+#ifndef _STATEITEMMANAGER_H_
+   #include "T3D/stateItemManager.h"
+#endif
+#ifndef _MPOLYHEDRON_H_
+   #include "math/mPolyhedron.h"
+#endif
+#ifndef _EXTRUDEDPOLYLIST_H_
+   #include "collision/extrudedPolyList.h"
+#endif
+#ifndef _EARLYOUTPOLYLIST_H_
+   #include "collision/earlyOutPolyList.h"
+#endif
+#ifndef _COLLISION_H_
+   #include "collision/collision.h"
+#endif
 
 class PhysicsBody;
+class InfiniteBitStream;
+class StateItem;
+
+/// Per state profiling counters, see StateItemData::profile.  On by default
+/// in debug and profiler builds; define STATEITEM_PROFILE to have them in
+/// others.  Even when built in they cost nothing until StateItem::profile
+/// is set.
+#if !defined(STATEITEM_PROFILE) && (defined(TORQUE_DEBUG) || defined(TORQUE_ENABLE_PROFILER))
+   #define STATEITEM_PROFILE
+#endif
+
+#ifdef STATEITEM_PROFILE
+   #define STATEITEM_PROFILE_SPAWN(item, kind) (item)->profileSpawn(StateItemData::kind)
+#else
+   #define STATEITEM_PROFILE_SPAWN(item, kind)
+#endif
 
 
 //----------------------------------------------------------------------------
@@ -45,6 +79,32 @@ struct StateItemData: public ItemData {
 
    bool        simpleServerCollision;
 
+   /// @name Continuous collision
+   /// @{
+   bool        continuousCollision;   ///< Sweep fast items in substeps against the swept box.
+   F32         ccdVelocityThreshold;  ///< Speed above which the swept test kicks in.
+   S32         ccdMaxSubsteps;        ///< Most substeps one tick is split into.
+   /// @}
+
+   /// @name Network quantization
+   /// @{
+   S32         netPositionBits;       ///< Bits per position component, 0 sends full floats.
+   S32         netVelocityBits;       ///< Bits per velocity component relative to maxVelocity, 0 sends full floats.
+   Box3F       netBounds;             ///< Positions are quantized inside this, empty uses the MissionArea.
+   Box3F       mNetBounds;            ///< The bounds the clients were sent.
+   bool        mNetBoundsPending;     ///< No MissionArea yet, fixed on the first packData.
+
+   /// netBounds, or the MissionArea's if they are empty.  Returns false if
+   /// there are neither.
+   bool getNetBounds(Box3F* bounds) const;
+
+   /// Server side, clamps the bit counts to what packData can send, zeroes
+   /// them without bounds or a maxVelocity, and fixes mNetBounds once.
+   /// packData and StateItem::packUpdate go by the result only, so every
+   /// client quantizes the same way the server does.
+   void fixNetQuantization();
+   /// @}
+
    //=============================================================
    //States and other image-effective codestuffs here
    //Advanced StateItem Support
@@ -59,6 +119,8 @@ public:
       MaxGenericTriggers = 4,       ///< The number of generic triggers for the image.
 
       NumStateBits = 5,
+
+      MaxStrings = MaxStates * 2 + 1, ///< State names, shape sequences and "" in the compiled states.
    };
    enum LightType {
       NoLight = 0,
@@ -68,6 +130,22 @@ public:
       WeaponFireLight,
       NumLightTypes
    };
+
+   /// Inputs that drive a state transition, packed into the index of the
+   /// compiled transition table.
+   enum TransitionInputs {
+      LoadedInput          = BIT(0),
+      AmmoInput            = BIT(1),
+      TargetInput          = BIT(2),
+      WetInput             = BIT(3),
+      MotionInput          = BIT(4),
+      TriggerInput         = BIT(5),
+      AltTriggerInput      = BIT(6),
+      GenericTriggerInput  = BIT(7),   ///< First of MaxGenericTriggers consecutive bits.
+
+      NumTransitionInputBits = 7 + MaxGenericTriggers,
+      TransitionTableSize    = 1 << NumTransitionInputBits,
+   };
    struct StateData {
       StateData();
       const char* name;             ///< State name
@@ -268,6 +346,17 @@ public:
                                     ///  if you're animating the camera using an image's 'eye' node -- unless the movement
                                     ///  is very subtle and doesn't need to be reflected on the server.
 
+   /// @name Animation LOD
+   ///
+   /// How often the client advances an item's animation threads.  Thread
+   /// time that isn't advanced is kept and applied in one step later, which
+   /// TSShapeInstance handles exactly for looping and clamped sequences.
+   /// @{
+   bool animCullOffscreen;          ///< Don't advance threads while the item isn't rendered.
+   F32  animLODDistance;            ///< Past this distance from the camera threads advance every animLODInterval, 0 disables.
+   F32  animLODInterval;            ///< Seconds between thread updates past animLODDistance.
+   /// @}
+
    F32 scriptAnimTransitionTime;    ///< The amount of time to transition between the previous sequence and new sequence
                                     ///< when the script prefix has changed.
 
@@ -367,7 +456,160 @@ public:
    /// @{
    StateData state[MaxStates];   ///< Array of states.
    bool      statesLoaded;       ///< Are the states loaded yet?
+
+   /// Interned state name to state index, built onAdd.
+   typedef HashTable<StringTableEntry, S32> StateNameMap;
+   StateNameMap stateNameMap;
+   /// @}
+
+   /// @name Transition Table
+   ///
+   /// Every state's transition block is compiled onAdd into a row of
+   /// TransitionTableSize entries, indexed by the packed TransitionInputs.
+   /// Each entry holds the state the if/else chain in updateState() would
+   /// pick (same priority order), or -1 if none fires.  The timeout
+   /// transition is not part of the table.
+   ///
+   /// @{
+   Vector<S8> transitionTable;
+
+   void compileTransitionTable();
+
+   /// Next state for the given state and input bits, or -1.
+   S32 lookupTransition(U32 stateIdx, U32 inputs) const
+   {
+      return transitionTable[(stateIdx << NumTransitionInputBits) | inputs];
+   }
+   /// @}
+
+   /// @name Ready Table
+   ///
+   /// Whether a fire state can be reached from each state within
+   /// MaxReadyDepth transitions, for each combination of the inputs
+   /// StateItem::isReady looks at, as a bit per combination.  The trigger
+   /// inputs aren't part of the key, readiness assumes they are pressed.
+   ///
+   /// @{
+   enum {
+      MaxReadyDepth = 6,
+      ReadyInputBits = 5 + MaxGenericTriggers,   ///< Loaded to motion, then the generic triggers.
+      ReadyKeyCount = 1 << ReadyInputBits,
+      ReadyWords = ReadyKeyCount / 32,
+   };
+   Vector<U32> readyTable;
+
+   void compileReadyTable();
+
+   /// Packs the TransitionInputs isReady looks at into a ready table key.
+   static U32 getReadyKey(U32 inputs)
+   {
+      return (inputs & (TriggerInput - 1)) | ((inputs / GenericTriggerInput) << 5);
+   }
+
+   /// Whether a fire state is reachable from stateIdx, depth transitions in.
+   bool lookupReady(U32 stateIdx, U32 depth, U32 inputs) const
+   {
+      if (depth >= MaxReadyDepth)
+         return false;
+      U32 key = getReadyKey(inputs);
+      return (readyTable[(depth * MaxStates + stateIdx) * ReadyWords + key / 32] & (1 << (key % 32))) != 0;
+   }
+   /// @}
+
+   /// @name Compiled States
+   ///
+   /// The client's share of the state table, compiled once on the server
+   /// after preload into a self-contained bit stream: a table of interned
+   /// strings, then each named state's resolved transition indices, flags
+   /// and non-default values, with strings as table indices.  packData
+   /// sends the block as is, so packing for another connection is a copy.
+   /// The client keeps the block it received and unpacks its states from
+   /// it; repacking it, e.g. for a demo, doesn't rebuild it.
+   ///
+   /// Normally only the block's hash goes with the datablock, and the client
+   /// takes the block from its StateItemDataCache or asks the server for it.
+   ///
+   /// @{
+   Vector<U8> mStateBlob;
+   U64 mStateBlobHash;
+   bool mStatesPending;          ///< Client is waiting on the server for the block.
+
+   void compileStateBlob();
+
+   /// Takes the states from a block the server sent, after preload.
+   void installStateBlob(const Vector<U8>& blob);
+   void packStates(InfiniteBitStream* stream);
+   void unpackStates(BitStream* stream);
+   /// @}
+
+   /// @name State Callbacks
+   ///
+   /// Each state's script function is bound onAdd, either to a native
+   /// handler registered under its name with registerStateCallback(), or
+   /// to the Namespace entry it resolves to on this datablock.  Entering
+   /// the state then calls it directly, without the console's lookup.
+   /// The bindings are redone when the console's namespace cache has been
+   /// trashed since, e.g. after scripts are exec'd or a package activated.
+   ///
+   /// @{
+
+   /// Native state callback, given the datablock, the item and what it is
+   /// mounted to, if anything.
+   typedef void (*StateCallbackFn)(StateItemData* dataBlock, StateItem* obj, SceneObject* holder);
+
+   /// Handles the state script function called name for every StateItemData.
+   static void registerStateCallback(const char* name, StateCallbackFn fn);
+
+   /// The per state bindings, kept in stateItem.cpp along with the console
+   /// internals they need.  NULL until first bound.
+   struct StateCallbackTable;
+   StateCallbackTable* mStateCallbacks;
+   U32 mCallbackSequence;        ///< Namespace::mCacheSequence we were bound at.
+
+   void bindStateCallbacks();
+
+   /// Calls the script function of state stateIdx for obj.
+   void invokeStateCallback(U32 stateIdx, StateItem* obj);
+   /// @}
+
+#ifdef STATEITEM_PROFILE
+   /// @name Profiling
+   ///
+   /// Counted while StateItem::profile is set.  State times, transitions
+   /// and callbacks are counted for server items, spawns for client ones,
+   /// so a listen server sharing its datablocks doesn't count twice.
+   /// @{
+   enum ProfileSpawn
+   {
+      EmitterSpawn,
+      SoundSpawn,
+      LightSpawn,                ///< Admitted by the StateItemLightBudget.
+      NumProfileSpawns
+   };
+
+   struct StateProfile
+   {
+      SimTime time;              ///< Ms items spent in the state.
+      U32 entries;
+      U32 callbacks;
+      S32 callbackMs;            ///< Sampled off a ms timer, good over many calls.
+      U32 spawns[NumProfileSpawns];
+   };
+   StateProfile profile[MaxStates];
+   HashTable<U32, U32> profileEdges;   ///< Transition counts, by from << 16 | to.
+   SimTime profileStart;
+
+   void resetProfile();
+
+   /// An item left state from, -1 if none, for to after timeInFrom ms.
+   void profileTransition(S32 from, U32 to, SimTime timeInFrom);
+   void profileSpawn(S32 state, ProfileSpawn kind) { if (state >= 0) profile[state].spawns[kind]++; }
+
+   /// The counters as CSV lines: a table of states, a blank line, and a
+   /// table of transitions.
+   void getProfileCSV(Vector<String>& lines);
    /// @}
+#endif
 
    /// @name Callbacks
    /// @{
@@ -377,11 +619,14 @@ public:
    //-JR
 
    StateItemData();
+   ~StateItemData();
    DECLARE_CONOBJECT(StateItemData);
    //-JR
    bool onAdd();
    bool preload(bool server, String &errorStr);
    S32 lookupState(const char* name);  ///< Get a state by name.
+   S32 findState(const char* name);    ///< Get a state by name, -1 if there is none.
+   void buildStateNameMap();
    void inspectPostApply();
    //-JR
    static void initPersistFields();
@@ -392,6 +637,17 @@ public:
 
 //----------------------------------------------------------------------------
 
+/// Collision scratch for StateItem::sweepMove.
+///
+/// One per thread running the physics stage, owned by StateItemManager.
+struct StateItemCollisionScratch
+{
+   Polyhedron boxPolyhedron;
+   ExtrudedPolyList extrudedPolyList;
+   EarlyOutPolyList earlyOutPolyList;
+   CollisionList collisionList;
+};
+
 //-JR
 class StateItem: public Item
 {
@@ -409,7 +665,9 @@ public:
 	   
 	  StateMask			= Parent::NextFreeMask << 0,
       ManualStateMask	= Parent::NextFreeMask << 1,
-      NextFreeMask		= Parent::NextFreeMask << 2
+      FlagMask          = Parent::NextFreeMask << 2,   ///< Loaded, ammo, target and wet inputs.
+      TriggerMask       = Parent::NextFreeMask << 3,   ///< Trigger inputs and fireCount.
+      NextFreeMask		= Parent::NextFreeMask << 4
 	  //-JR
    };
 
@@ -428,11 +686,26 @@ protected:
 public:
    StateItemData* mDataBlock;
 
+#ifdef STATEITEM_PROFILE
+   /// Fill in StateItemData::profile.
+   static bool smProfile;
+
+   void profileSpawn(StateItemData::ProfileSpawn kind)
+   {
+      if (smProfile && isGhost())
+         mDataBlock->profileSpawn(getStateIndex(), kind);
+   }
+#endif
+
 protected:
    static F32 mGravity;
    bool mStatic;
    bool mRotate;
 
+#ifdef STATEITEM_PROFILE
+   SimTime mProfileStateEnter;   ///< When the current state was entered.
+#endif
+
    //
    VectorF mVelocity;
    bool mAtRest;
@@ -447,24 +720,81 @@ protected:
 
    PhysicsBody *mPhysicsRep;
 
+   /// @name Network tiers
+   ///
+   /// How much of our update each connection gets, see packUpdate.
+   /// @{
+   enum NetTier {
+      HolderTier,    ///< The connection controls what we are mounted to.
+      NearTier,      ///< Close, or in front of the camera and not far.
+      FarTier        ///< Reduced rate and coarse positions.
+   };
+   NetTier getNetTier(NetConnection* conn);
+
+   struct NetConnectionState {
+      SimObjectPtr<NetConnection> conn;
+      SimTime lastPositionTime;     ///< When the connection last got our position.
+   };
+   Vector<NetConnectionState> mNetConnectionStates;
+   NetConnectionState& getNetConnectionState(NetConnection* conn);
+
+   /// The inputs the clients get, the rest are server side only.
+   static const U32 csmNetInputs;
+   /// @}
+
    //-JR
-   StateItemData::StateData *state;
+   friend class StateItemManager;
+   friend class StateItemLightBudget;
+   friend class StateItemRecorder;
+
+   /// @name Batched state
+   ///
+   /// The fields the state machine reads every tick live in the
+   /// StateItemManager batch for mDataBlock; these are views into it.
+   /// @{
+   StateItemManager::Batch* mBatch;
+   U32 mBatchSlot;
+   bool mSleeping;               ///< Parked by the manager, see canSleep().
+
+   /// Current state, NULL if none.
+   StateItemData::StateData* getStateData() const
+   {
+      S32 index = getStateIndex();
+      return (index < 0) ? NULL : &mDataBlock->state[index];
+   }
+
+   /// Index of state in mDataBlock->state, -1 if none.
+   S32 getStateIndex() const { return mBatch ? mBatch->stateIndex[mBatchSlot] : -1; }
+
+   F32& delayTime()   { AssertFatal(mBatch, "StateItem::delayTime - not in a batch"); return mBatch->delayTime[mBatchSlot]; }   ///< Time till next state.
+   F32& remainingDt() { AssertFatal(mBatch, "StateItem::remainingDt - not in a batch"); return mBatch->remainingDt[mBatchSlot]; } ///< Remaining delta time for state transitions
+
+   /// Fire skip count.
+   ///
+   /// This is incremented every time the triggerDown bit is changed,
+   /// so that the engine won't be too confused if the player toggles the
+   /// trigger a bunch of times in a short period.
+   ///
+   /// @note The network deals with this variable at 3-bit precision, so it
+   /// can only range 0-7.
+   ///
+   /// @see StateItem::setState()
+   U32& fireCount()   { AssertFatal(mBatch, "StateItem::fireCount - not in a batch"); return mBatch->fireCount[mBatchSlot]; }
+
+   /// Loaded/ammo/target/wet/motion/trigger/generic flags, as
+   /// StateItemData::TransitionInputs bits.
+   bool getInput(U32 bit) const { return mBatch && (mBatch->inputs[mBatchSlot] & bit); }
+   void setInput(U32 bit, bool set);
+
+   /// Called by the input setters.  Off the main thread, queues the call
+   /// with the StateItemManager as a StateItemManager::InputCommandType and
+   /// returns true, and the setter must leave the item alone.
+   bool queueInput(U32 type, bool value, U32 trigger = 0);
+   /// @}
+
    StateItemData::StateData *nextState;
 
-   bool loaded;                  ///< Is the image loaded?
    bool nextLoaded;              ///< Is the next state going to result in the image being loaded?
-   F32 delayTime;                ///< Time till next state.
-   F32 remainingDt;				 ///< Remaining delta time for state transitions
-   U32 fireCount;                ///< Fire skip count.
-                                 ///
-                                 /// This is incremented every time the triggerDown bit is changed,
-                                 /// so that the engine won't be too confused if the player toggles the
-                                 /// trigger a bunch of times in a short period.
-                                 ///
-                                 /// @note The network deals with this variable at 3-bit precision, so it
-                                 /// can only range 0-7.
-                                 ///
-                                 /// @see StateItem::setState()
 
    U32 altFireCount;             ///< Alternate fire skip count.
                                     ///< @see fireCount
@@ -472,17 +802,7 @@ protected:
    U32 reloadCount;              ///< Reload skip count.
                                     ///< @see fireCount
 
-
-   bool triggerDown;             ///< Is the trigger down?
-   bool altTriggerDown;          ///< Is the other trigger down?
-
-   bool ammo;                    ///< Do we have ammo?
-   bool target;                  ///< Do we have a target?
-   bool wet;					 //< are we wet?
-
-   bool motion;                  ///< Is the player in motion?
-
-   bool genericTrigger[StateItemData::MaxGenericTriggers];   ///< Generic triggers not assigned to anything in particular.  These
+   U32 mNetFireCount;            ///< Last fireCount received from the server, on ghosts.
 
 
    S32 mountPoint;				 //where are we mounting?
@@ -506,17 +826,22 @@ protected:
    SimTime lightStart;     ///< Starting time for light flashes.
 
    bool animLoopingSound;  ///< Are we playing a looping sound?
-   Vector<SFXSource*> mSoundSources; ///< Vector of currently playing sounds
-   void updateSoundSources(const MatrixF& renderTransform);  
-   void addSoundSource(SFXSource* source);
+   /// Plays track through the StateItemVoicePool, which owns the source.
+   void addSoundSource(SFXTrack* track);
 
    /// Represent the state of a specific particle emitter on the image.
+   /// The emitter is borrowed from the StateItemEmitterPool.
    struct StateItemEmitter {
       S32 node;
       F32 time;
+      bool restart;        ///< Don't trail particles from where the emitter was last used.
       SimObjectPtr<ParticleEmitter> emitter;
    };
    StateItemEmitter emitter[MaxImageEmitters];
+
+   /// Called by the StateItemEmitterPool when it gives one of our
+   /// emitters to another item.
+   void onEmitterStolen(ParticleEmitter* stolen);
    //-JR
 
   protected:
@@ -553,6 +878,7 @@ protected:
   private:
    S32         mDropTime;
    LightInfo*  mLight;
+   bool        mLightAdmitted;   ///< Within the StateItemLightBudget this frame.
 
   public:
 
@@ -565,8 +891,65 @@ protected:
    Box3F          mWorkingQueryBox;
 
    void updateVelocity(const F32 dt);
-   void updatePos(const U32 mask, const F32 dt);
-   void updateWorkingCollisionSet(const U32 mask, const F32 dt);
+
+   /// @name Physics stage
+   ///
+   /// Driven by StateItemManager for every moving item, in the order
+   /// updateVelocity, updateWorkingQueryBox, updateWorkingCollisionSet
+   /// (only if the query box changed), beginMove, sweepMove, endMove.
+   /// sweepMove may run on any thread; the rest run on the main thread.
+   /// @{
+
+   /// A collision found by sweepMove, queued by endMove.
+   struct MoveHit
+   {
+      SimObjectId objectId;      ///< Looked up again in endMove, script may have deleted it.
+      VectorF velocity;          ///< Ours after the hit; endMove makes it relative.
+   };
+
+   enum {
+      MaxMoveHits = 8,           ///< Hits kept for endMove, the rest are dropped.
+   };
+
+   /// The move in progress between beginMove and endMove.
+   struct PendingMove
+   {
+      Point3F pos;
+      bool contact;
+      bool nonStatic;
+      bool stickyNotify;
+      bool doToughCollision;
+      U32 hitCount;
+      MoveHit hits[MaxMoveHits];
+   };
+   PendingMove mMove;
+
+   /// Contact ray cast below the item.
+   void beginMove(const F32 dt);
+
+   /// Sweeps the box against the working list and resolves the hits.
+   void sweepMove(StateItemCollisionScratch& scratch, const F32 dt);
+
+   /// One substep of sweepMove, resolving up to three hits.  Returns false
+   /// if the item stopped.  With swept set the early out tests the box
+   /// swept over the substep rather than just where it ends.
+   bool sweepStep(StateItemCollisionScratch& scratch, Point3F& pos, F32 time, bool swept);
+
+   /// Commits the new position and runs the collision callbacks.
+   void endMove(const F32 dt);
+
+   /// True if the item needs the physics stage this tick.
+   bool isMoving();
+   U32 getCollisionMask() const;
+
+   /// Grows mWorkingQueryBox if the coming move would leave it.
+   /// @return True if the working list has to be rebuilt.
+   bool updateWorkingQueryBox(const F32 dt);
+
+   /// Rebuilds the working list from a shared broadphase query.
+   /// @param candidates Objects overlapping at least mWorkingQueryBox.
+   void updateWorkingCollisionSet(const Vector<SceneObject*>& candidates);
+   /// @}
    bool buildPolyList(PolyListContext context, AbstractPolyList* polyList, const Box3F &box, const SphereF &sphere);
    void buildConvex(const Box3F& box, Convex* convex);
    //virtual void onDeleteNotify(SimObject*); //may not need? -JR
@@ -591,6 +974,17 @@ protected:
 
    bool isStatic()   { return mStatic; }
    bool isAtRest()   { return mAtRest; }
+   bool isSleeping() { return mSleeping; }
+
+   /// True if nothing will happen to this item until something outside
+   /// pokes it: it is at rest, unmounted, and its state has no timeout
+   /// and no transition for its current flags.  On the server it must
+   /// also be static or sticky.
+   bool canSleep();
+
+   /// Puts a sleeping item back on the tick list.  Called by anything
+   /// that moves the item or changes its state machine inputs.
+   void wakeUp();
    bool isRotating() { return mRotate; }
    Point3F getVelocity() const;
    void setVelocity(const VectorF& vel);
@@ -601,6 +995,16 @@ protected:
    void processTick(const Move *move);
    void interpolateTick(F32 delta); //-JR
    virtual void setTransform(const MatrixF &mat);
+   virtual void setRenderTransform(const MatrixF &mat);
+   virtual void onMount( SceneObject *obj, S32 node );
+   virtual void onUnmount( SceneObject *obj, S32 node );
+
+   /// Something ran into us; wakes us so a sleeping item reacts to it.
+   virtual void onCollision( SceneObject *object, const VectorF &vec );
+
+   /// Client side, places us on our mount.  Called by StateItemManager
+   /// once a frame in mount order.
+   void updateMountTransform(F32 dt);
 
    U32  packUpdate  (NetConnection *conn, U32 mask, BitStream *stream);
    void unpackUpdate(NetConnection *conn,           BitStream *stream);
@@ -617,7 +1021,9 @@ protected:
    /// @param   imageSlot   Mountpoint
    bool isReloading();
 
-	bool isReady(U32 ns,U32 depth);
+	/// Whether pressing the trigger leads to a fire state from state ns,
+	/// -1 for the current one.  A StateItemData::readyTable lookup.
+	bool isReady(U32 ns = -1,U32 depth = 0);
 	//bool isMounted(StateItemData* imageData);
 	//S32 ShapeBase::getMountSlot(StateItemData* imageData)
 	NetStringHandle getSkinTag();
@@ -656,7 +1062,7 @@ protected:
 	void getMuzzlePoint(Point3F* pos);
 	void getRenderMuzzleVector(VectorF* vec);
 	void getRenderMuzzlePoint(Point3F* pos);
-	void scriptCallback(const char* function);
+	void scriptCallback(U32 stateIdx);
 	void getMountTransform( S32 index, const MatrixF &xfm, MatrixF *outMat );
 	void getStateItemTransform(MatrixF* mat);
 	void getStateItemTransform(S32 node,MatrixF* mat);
@@ -669,8 +1075,36 @@ protected:
 	void getRenderMuzzleTransform(MatrixF* mat);
 	void getRetractionTransform(MatrixF* mat);
 	void getRenderRetractionTransform(MatrixF* mat);
+
+	/// @name Render transform cache
+	///
+	/// The world transforms the render getters build for the image and the
+	/// nodes it uses (muzzle, eject, emitter, retract, eye) are kept until
+	/// mRenderGeneration moves on, which it does when the render transform
+	/// is set, the threads advance, the state changes or the shape is
+	/// animated for rendering.
+	/// @{
+	enum { MaxCachedTransforms = 6 };
+	struct CachedTransform {
+	   S32 node;                  ///< -1 for the image transform.
+	   U32 generation;
+	   MatrixF mat;
+	};
+	CachedTransform mTransformCache[MaxCachedTransforms];
+	U32 mTransformCacheNext;      ///< Entry replaced on the next miss.
+	U32 mRenderGeneration;
+
+	void invalidateRenderTransforms() { mRenderGeneration++; }
+	bool findCachedTransform(S32 node, MatrixF* mat) const;
+	void cacheTransform(S32 node, const MatrixF& mat);
+	/// @}
+
 	S32  getNodeIndex(StringTableEntry nodeName);
 	bool getCorrectedAim(const MatrixF& muzzleMat, VectorF* result);
+	/// True if the muzzle vector getters correct toward the camera ray.
+	bool usesCorrectedAim();
+	/// The camera ray getCorrectedAim traces, 500m ahead of the eye.
+	void getAimRay(Point3F* start, Point3F* end);
 	void updateMass();
 	virtual void onStateItem(bool unmount);
     virtual void onRecoil(StateItemData::StateData::RecoilState);
@@ -697,7 +1131,16 @@ protected:
     virtual const char* getAnimPrefix() { return ""; }
 
 	void updateState(F32 dt);
+
+	/// Sets the spin thread timeScale for a SpinUp/SpinDown state.
+	void updateSpinThread(const StateItemData::StateData& stateData);
+
+	/// Packs the current loaded/ammo/target/wet/motion/trigger/generic
+	/// flags into StateItemData::TransitionInputs bits.
+	U32 getTransitionInputs() const;
 	void startStateItemEmitter(StateItemData::StateData& state);
+	/// Brightness of the datablock light right now, <= 0 if it is off.
+	F32 getLightIntensity() const;
 	void submitLights( LightManager *lm, bool staticLighting );
 	void ejectShellCasing();
 
@@ -711,7 +1154,7 @@ protected:
    /// Sets the state of the StateItem
    /// @param   state       State id
    /// @param   force       Force image to state or let it finish then change
-   const char* getState(){if(state) return state->name; return "";}
+   const char* getState(){StateItemData::StateData* sd = getStateData(); if(sd) return sd->name; return "";}
 
    /// Sets the generic trigger state of the image
    /// @param   imageSlot   Image slot
@@ -729,6 +1172,23 @@ protected:
    /// @param   dt          Change in time since last animation update
    void updateAnimation(F32 dt);
 
+   /// Emits from the state emitters, after we have been placed this frame.
+   void updateEmitters(F32 dt);
+
+   /// @name Animation LOD
+   /// @see StateItemData::animCullOffscreen
+   /// @{
+   F32  mAnimPendingDt;          ///< Thread time not advanced yet.
+   bool mAnimVisible;            ///< Rendered since the last updateAnimation.
+   F32  mAnimCameraDistSq;       ///< Squared distance from the camera we were last rendered from.
+
+   /// Whether the threads are due, going by distance.
+   bool isAnimDue() const;
+
+   /// Advances the threads by the pending time.
+   void advanceThreads();
+   /// @}
+
    /// Start up the particle emitter
    /// @param   state   State
    void startEmitter(StateItemData::StateData &state);
@@ -738,11 +1198,11 @@ protected:
    /// @param   trigger   True if the trigger is depressed
    /// @param   alt       True to set the value of the alt trigger
    void setTrigger(bool trigger, bool alt = false);
-   bool getTrigger(bool alt = false){if(alt) return altTriggerDown; return triggerDown;}
+   bool getTrigger(bool alt = false){return getInput(alt ? StateItemData::AltTriggerInput : StateItemData::TriggerInput);}
 
    /// Sets the flag that signals the image is loaded with ammo
    /// @param   loaded   True if loaded with ammo
-   bool getTarget(){ return target;}
+   bool getTarget(){ return getInput(StateItemData::TargetInput);}
    void setTarget(bool hasTarget);
 
    void throwCallback(const char* callback);
@@ -0,0 +1,257 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemCasings.h"
+
+#include "T3D/debris.h"
+#include "T3D/gameBase/gameProcess.h"
+#include "collision/collision.h"
+#include "gfx/gfxTransformSaver.h"
+#include "materials/materialManager.h"
+#include "materials/materialFeatureTypes.h"
+#include "math/mathUtils.h"
+#include "math/mRandom.h"
+#include "platform/profiler.h"
+#include "scene/sceneRenderState.h"
+#include "ts/tsShapeInstance.h"
+
+
+IMPLEMENT_CONOBJECT(StateItemCasingSet);
+
+ConsoleDocClass( StateItemCasingSet,
+   "@brief Client side shell casings ejected by StateItems, one set per DebrisData.\n\n"
+   "Created automatically; see StateItemData::casing.\n\n"
+   "@ingroup GameObjects\n"
+);
+
+StateItemCasingSet::SetMap StateItemCasingSet::smSets;
+
+S32 StateItemCasingSet::smMaxCasings = 64;
+
+// Below this speed a casing on the ground stops.
+static const F32 sRestSpeedSq = 0.2f * 0.2f;
+
+// How far below the ejection point to look for the ground.
+static const F32 sGroundCastDist = 50.0f;
+
+//----------------------------------------------------------------------------
+
+StateItemCasingSet::StateItemCasingSet()
+{
+   mNetFlags.set(IsGhost);
+   mTypeMask |= DebrisObjectType;
+
+   mDataBlock = NULL;
+   mShapeInstance = NULL;
+   mHead = 0;
+   mLiveCount = 0;
+}
+
+StateItemCasingSet::~StateItemCasingSet()
+{
+   SAFE_DELETE(mShapeInstance);
+}
+
+StateItemCasingSet* StateItemCasingSet::get(DebrisData* dataBlock)
+{
+   SetMap::Iterator itr = smSets.find(dataBlock);
+   if (itr != smSets.end())
+      return itr->value;
+
+   if (!dataBlock->shape)
+      return NULL;
+
+   StateItemCasingSet* set = new StateItemCasingSet;
+   set->mDataBlock = dataBlock;
+   if (!set->registerObject())
+   {
+      delete set;
+      return NULL;
+   }
+   return set;
+}
+
+bool StateItemCasingSet::onAdd()
+{
+   if (!mDataBlock || !Parent::onAdd())
+      return false;
+
+   // Instanced materials, so all the casings go out in one draw.
+   mShapeInstance = new TSShapeInstance(mDataBlock->shape, false);
+   FeatureSet features = MATMGR->getDefaultFeatures();
+   features.addFeature(MFT_UseInstancing);
+   mShapeInstance->cloneMaterialList(&features);
+   mShapeInstance->animate();
+
+   // All dead to start with.
+   mCasings.setSize(getMax(smMaxCasings, 1));
+   for (U32 i = 0; i < mCasings.size(); i++)
+   {
+      mCasings[i].age = 0.0f;
+      mCasings[i].lifetime = 0.0f;
+   }
+   mHead = 0;
+   mLiveCount = 0;
+
+   setGlobalBounds();
+   resetWorldBox();
+   addToScene();
+
+   smSets.insertUnique(mDataBlock, this);
+   deleteNotify(mDataBlock);
+
+   ClientProcessList::get()->postTickSignal().notify( this, &StateItemCasingSet::_onPostTick );
+   return true;
+}
+
+void StateItemCasingSet::onRemove()
+{
+   ClientProcessList::get()->postTickSignal().remove( this, &StateItemCasingSet::_onPostTick );
+
+   smSets.erase(mDataBlock);
+   removeFromScene();
+
+   Parent::onRemove();
+}
+
+void StateItemCasingSet::onDeleteNotify(SimObject* object)
+{
+   // Our shape and settings go with the datablock.
+   if (object == mDataBlock)
+      deleteObject();
+
+   Parent::onDeleteNotify(object);
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemCasingSet::eject(const MatrixF& orient, const Point3F& pos, const Point3F& vel)
+{
+   if (mCasings.empty())
+      return;
+
+   // The oldest goes if we are full.
+   Casing& casing = mCasings[mHead];
+   if (casing.age >= casing.lifetime)
+      mLiveCount++;
+   mHead = (mHead + 1) % mCasings.size();
+
+   casing.pos = pos;
+   casing.vel = vel;
+   casing.orient = orient;
+   casing.orient.setPosition(Point3F::Zero);
+   casing.axis.set(gRandGen.randF(-1.0f, 1.0f), gRandGen.randF(-1.0f, 1.0f), gRandGen.randF(-1.0f, 1.0f));
+   casing.axis.normalizeSafe();
+   if (casing.axis.isZero())
+      casing.axis.set(0.0f, 0.0f, 1.0f);
+   casing.angle = 0.0f;
+   casing.spin = mDegToRad(gRandGen.randF(mDataBlock->minSpinSpeed, mDataBlock->maxSpinSpeed));
+   casing.age = 0.0f;
+   casing.lifetime = mDataBlock->lifetime + gRandGen.randF(-mDataBlock->lifetimeVariance, mDataBlock->lifetimeVariance);
+   casing.resting = false;
+
+   // One ray per casing, after that it only knows about this plane.
+   RayInfo rinfo;
+   Point3F end = pos - Point3F(0.0f, 0.0f, sGroundCastDist);
+   if (gClientContainer.castRay(pos, end, STATIC_COLLISION_TYPEMASK, &rinfo))
+      casing.groundZ = rinfo.point.z;
+   else
+      casing.groundZ = -F32_MAX;
+}
+
+void StateItemCasingSet::_onPostTick(SimTime elapsedMs)
+{
+   if (mLiveCount)
+      advance(elapsedMs / 1000.0f);
+}
+
+void StateItemCasingSet::advance(F32 dt)
+{
+   PROFILE_SCOPE(StateItemCasingSet_Advance);
+
+   F32 gravity = -9.81f * mDataBlock->gravModifier;
+   F32 elasticity = mDataBlock->elasticity;
+   F32 friction = mClampF(mDataBlock->friction, 0.0f, 1.0f);
+
+   mLiveCount = 0;
+   for (U32 i = 0; i < mCasings.size(); i++)
+   {
+      Casing& casing = mCasings[i];
+      if (casing.age >= casing.lifetime)
+         continue;
+
+      casing.age += dt;
+      if (casing.age >= casing.lifetime)
+         continue;
+      mLiveCount++;
+
+      if (casing.resting)
+         continue;
+
+      casing.vel.z += gravity * dt;
+      casing.pos += casing.vel * dt;
+      casing.angle += casing.spin * dt;
+
+      if (casing.pos.z < casing.groundZ)
+      {
+         casing.pos.z = casing.groundZ;
+         if (casing.vel.z < 0.0f)
+            casing.vel.z = -casing.vel.z * elasticity;
+         casing.vel.x *= 1.0f - friction;
+         casing.vel.y *= 1.0f - friction;
+         casing.spin *= elasticity;
+
+         if (casing.vel.lenSquared() < sRestSpeedSq)
+         {
+            casing.vel.zero();
+            casing.resting = true;
+         }
+      }
+   }
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemCasingSet::prepRenderImage(SceneRenderState* state)
+{
+   if (!mLiveCount || !mShapeInstance)
+      return;
+
+   PROFILE_SCOPE(StateItemCasingSet_PrepRender);
+
+   GFXTransformSaver saver;
+
+   TSRenderState rdata;
+   rdata.setSceneState(state);
+   rdata.setFadeOverride(1.0f);
+
+   const Frustum& frustum = state->getCullingFrustum();
+   const Box3F& shapeBox = mShapeInstance->getShape()->bounds;
+   F32 radius = shapeBox.len() * 0.5f;
+
+   for (U32 i = 0; i < mCasings.size(); i++)
+   {
+      const Casing& casing = mCasings[i];
+      if (casing.age >= casing.lifetime)
+         continue;
+
+      if (frustum.isCulled(SphereF(casing.pos, radius)))
+         continue;
+
+      F32 dist = (casing.pos - state->getDiffuseCameraPosition()).len();
+      mShapeInstance->setDetailFromDistance(state, dist);
+      if (mShapeInstance->getCurrentDetail() < 0)
+         continue;
+
+      MatrixF mat;
+      AngAxisF(casing.axis, casing.angle).setMatrix(&mat);
+      mat.mul(casing.orient);
+      mat.setPosition(casing.pos);
+
+      GFX->setWorldMatrix(mat);
+      mShapeInstance->render(rdata);
+   }
+}
@@ -0,0 +1,95 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMCASINGS_H_
+#define _STATEITEMCASINGS_H_
+
+#ifndef _SCENEOBJECT_H_
+   #include "scene/sceneObject.h"
+#endif
+#ifndef _TDICTIONARY_H_
+   #include "core/util/tDictionary.h"
+#endif
+
+class DebrisData;
+class TSShapeInstance;
+
+//----------------------------------------------------------------------------
+
+/// The shell casings ejected by StateItems for one DebrisData, on the client.
+///
+/// Instead of a Debris object per round, the casings are plain records in a
+/// ring buffer of smMaxCasings entries.  Ejecting a casing when the buffer
+/// is full recycles the oldest one.  Each casing flies ballistically and
+/// bounces off a ground plane found with a single ray cast when it was
+/// ejected; it doesn't collide with anything else.  All casings share one
+/// TSShapeInstance with an instancing material list, so the render manager
+/// draws them as one instanced batch.
+///
+/// The sets are created on demand by get() and delete themselves along with
+/// their DebrisData.
+class StateItemCasingSet : public SceneObject
+{
+   typedef SceneObject Parent;
+
+public:
+
+   StateItemCasingSet();
+   ~StateItemCasingSet();
+
+   /// Returns the set for dataBlock, creating it if need be.  Returns NULL
+   /// if the datablock has no shape.
+   static StateItemCasingSet* get(DebrisData* dataBlock);
+
+   /// Casings kept per set; only read when a set is created.
+   static S32 smMaxCasings;
+
+   /// Throws a casing from pos with the given orientation and velocity.
+   void eject(const MatrixF& orient, const Point3F& pos, const Point3F& vel);
+
+   // SimObject
+   bool onAdd();
+   void onRemove();
+   void onDeleteNotify(SimObject* object);
+
+   // SceneObject
+   void prepRenderImage(SceneRenderState* state);
+
+   DECLARE_CONOBJECT(StateItemCasingSet);
+
+protected:
+
+   typedef HashTable<DebrisData*, StateItemCasingSet*> SetMap;
+   static SetMap smSets;
+
+   struct Casing
+   {
+      Point3F pos;
+      VectorF vel;
+      Point3F axis;              ///< Spin axis.
+      F32 angle;
+      F32 spin;                  ///< Radians per second.
+      F32 age;
+      F32 lifetime;              ///< Dead once age passes this.
+      F32 groundZ;               ///< Height of the plane it lands on.
+      bool resting;
+      MatrixF orient;            ///< Orientation at ejection.
+   };
+
+   DebrisData* mDataBlock;
+   TSShapeInstance* mShapeInstance;
+
+   /// The ring buffer, mHead is where the next casing goes.
+   Vector<Casing> mCasings;
+   U32 mHead;
+   U32 mLiveCount;
+
+   /// Hooked to the client process list post tick signal.
+   void _onPostTick(SimTime elapsedMs);
+
+   void advance(F32 dt);
+};
+
+#endif // _STATEITEMCASINGS_H_
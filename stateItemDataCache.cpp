@@ -0,0 +1,219 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemDataCache.h"
+
+#include "T3D/StateItem.h"
+#include "core/stream/bitStream.h"
+#include "core/stream/fileStream.h"
+#include "console/console.h"
+
+
+bool StateItemDataCache::smEnabled = true;
+const char* StateItemDataCache::smPath = "cache/stateItems";
+
+// Cache file header, "SIB1".
+static const U32 sCacheFileTag = 0x31424953;
+
+//----------------------------------------------------------------------------
+
+U64 StateItemDataCache::hash(const U8* data, U32 size)
+{
+   U64 h = 14695981039346656037ULL;
+   for (U32 i = 0; i < size; i++)
+   {
+      h ^= data[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+/// The directory name of the server we are connected to.  Local and demo
+/// connections share one.
+static String getServerDirectory()
+{
+   NetConnection* conn = NetConnection::getConnectionToServer();
+   if (!conn || conn->isLocalConnection() || !conn->getNetAddress())
+      return String("local");
+
+   char address[256];
+   Net::addressToString(conn->getNetAddress(), address);
+   for (char* c = address; *c; c++)
+      if (!dIsalnum(*c) && *c != '.')
+         *c = '_';
+   return String(address);
+}
+
+static String getCacheFileName(U64 hash)
+{
+   return String::ToString("%s/%s/%08x%08x.sib", StateItemDataCache::smPath,
+      getServerDirectory().c_str(), U32(hash >> 32), U32(hash));
+}
+
+bool StateItemDataCache::load(U64 hash, U32 size, Vector<U8>& data)
+{
+   if (size > MaxStatesSize)
+      return false;
+
+   FileStream stream;
+   if (!stream.open(getCacheFileName(hash), Torque::FS::File::Read))
+      return false;
+
+   U32 tag, fileSize;
+   if (!stream.read(&tag) || tag != sCacheFileTag ||
+       !stream.read(&fileSize) || fileSize != size)
+      return false;
+
+   data.setSize(size);
+   if (!stream.read(size, data.address()))
+      return false;
+
+   // Content addressed, so a bad file is one that doesn't hash right.
+   if (StateItemDataCache::hash(data.address(), size) != hash)
+   {
+      Con::warnf("StateItemDataCache: discarding corrupt entry %s", getCacheFileName(hash).c_str());
+      return false;
+   }
+   return true;
+}
+
+void StateItemDataCache::store(U64 hash, const Vector<U8>& data)
+{
+   String fileName = getCacheFileName(hash);
+   Platform::createPath(fileName.c_str());
+
+   FileStream stream;
+   if (!stream.open(fileName, Torque::FS::File::Write))
+   {
+      Con::warnf("StateItemDataCache: unable to write %s", fileName.c_str());
+      return;
+   }
+
+   stream.write(sCacheFileTag);
+   stream.write(U32(data.size()));
+   stream.write(data.size(), data.address());
+}
+
+void StateItemDataCache::requestStates(StateItemData* dataBlock)
+{
+   NetConnection* conn = NetConnection::getConnectionToServer();
+   if (!conn)
+   {
+      Con::errorf("StateItemDataCache: no server to request the states of %s from", dataBlock->getName());
+      return;
+   }
+   conn->postNetEvent(new StateItemStatesRequestEvent(dataBlock->getId()));
+}
+
+//----------------------------------------------------------------------------
+
+IMPLEMENT_CO_SERVEREVENT_V1(StateItemStatesRequestEvent);
+
+ConsoleDocClass( StateItemStatesRequestEvent,
+   "@brief Asks the server for the compiled states of a StateItemData the client has no cached copy of.\n\n"
+   "@ingroup GameObjects\n"
+);
+
+StateItemStatesRequestEvent::StateItemStatesRequestEvent(SimObjectId dataBlockId)
+{
+   mDataBlockId = dataBlockId;
+}
+
+void StateItemStatesRequestEvent::pack(NetConnection* conn, BitStream* stream)
+{
+   stream->writeRangedU32(mDataBlockId, DataBlockObjectIdFirst, DataBlockObjectIdLast);
+}
+
+void StateItemStatesRequestEvent::write(NetConnection* conn, BitStream* stream)
+{
+   pack(conn, stream);
+}
+
+void StateItemStatesRequestEvent::unpack(NetConnection* conn, BitStream* stream)
+{
+   mDataBlockId = stream->readRangedU32(DataBlockObjectIdFirst, DataBlockObjectIdLast);
+}
+
+void StateItemStatesRequestEvent::process(NetConnection* conn)
+{
+   StateItemData* dataBlock;
+   if (!Sim::findObject(mDataBlockId, dataBlock))
+   {
+      Con::errorf("StateItemStatesRequestEvent: no StateItemData with id %d", mDataBlockId);
+      return;
+   }
+   conn->postNetEvent(new StateItemStatesEvent(dataBlock));
+}
+
+//----------------------------------------------------------------------------
+
+IMPLEMENT_CO_CLIENTEVENT_V1(StateItemStatesEvent);
+
+ConsoleDocClass( StateItemStatesEvent,
+   "@brief Sends the compiled states of a StateItemData to a client that asked for them.\n\n"
+   "@ingroup GameObjects\n"
+);
+
+StateItemStatesEvent::StateItemStatesEvent(StateItemData* dataBlock)
+{
+   mDataBlockId = 0;
+   if (dataBlock)
+   {
+      mDataBlockId = dataBlock->getId();
+      if (dataBlock->mStateBlob.empty())
+         dataBlock->compileStateBlob();
+      mBlob = dataBlock->mStateBlob;
+   }
+}
+
+void StateItemStatesEvent::pack(NetConnection* conn, BitStream* stream)
+{
+   stream->writeRangedU32(mDataBlockId, DataBlockObjectIdFirst, DataBlockObjectIdLast);
+   stream->write(U32(mBlob.size()));
+   stream->write(mBlob.size(), mBlob.address());
+}
+
+void StateItemStatesEvent::write(NetConnection* conn, BitStream* stream)
+{
+   pack(conn, stream);
+}
+
+void StateItemStatesEvent::unpack(NetConnection* conn, BitStream* stream)
+{
+   mDataBlockId = stream->readRangedU32(DataBlockObjectIdFirst, DataBlockObjectIdLast);
+
+   // Don't let a bad packet pick how much we allocate, process() turns
+   // down the empty block.
+   U32 size;
+   stream->read(&size);
+   if (size > StateItemDataCache::MaxStatesSize)
+   {
+      mBlob.clear();
+      return;
+   }
+   mBlob.setSize(size);
+   stream->read(size, mBlob.address());
+}
+
+void StateItemStatesEvent::process(NetConnection* conn)
+{
+   StateItemData* dataBlock;
+   if (!Sim::findObject(mDataBlockId, dataBlock))
+   {
+      Con::errorf("StateItemStatesEvent: no StateItemData with id %d", mDataBlockId);
+      return;
+   }
+
+   U64 hash = StateItemDataCache::hash(mBlob.address(), mBlob.size());
+   if (mBlob.empty() || hash != dataBlock->mStateBlobHash)
+   {
+      Con::errorf("StateItemStatesEvent: states for %s don't match the datablock", dataBlock->getName());
+      return;
+   }
+
+   dataBlock->installStateBlob(mBlob);
+   StateItemDataCache::store(hash, mBlob);
+}
@@ -0,0 +1,102 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMDATACACHE_H_
+#define _STATEITEMDATACACHE_H_
+
+#ifndef _NETCONNECTION_H_
+   #include "sim/netConnection.h"
+#endif
+#ifndef _TVECTOR_H_
+   #include "core/util/tVector.h"
+#endif
+
+struct StateItemData;
+
+//----------------------------------------------------------------------------
+
+/// Client side disk cache of compiled StateItemData states.
+///
+/// The compiled states (see StateItemData::mStateBlob) are the bulk of a
+/// StateItemData.  The server sends only their content hash with the rest
+/// of the datablock.  The client looks the hash up in smPath, and only on a
+/// miss asks the server for the states with a StateItemStatesRequestEvent,
+/// storing the StateItemStatesEvent reply for next time.  Clients that
+/// reconnect to a server they have seen before download no states at all.
+///
+/// The hash is not collision resistant, so each server gets its own
+/// directory under smPath; a server can only ever spoil its own entries.
+class StateItemDataCache
+{
+public:
+
+   enum
+   {
+      /// Largest block of states accepted off the network or disk.  Well
+      /// over what MaxStates states with every string at its limit pack to.
+      MaxStatesSize = 256 * 1024,
+   };
+
+   /// If false the server sends the states with every datablock.
+   static bool smEnabled;
+
+   /// Directory the cached states are kept in.
+   static const char* smPath;
+
+   /// 64 bit FNV-1a of the compiled states.
+   static U64 hash(const U8* data, U32 size);
+
+   /// Reads the states with the given hash from the current server's
+   /// entries, returns false on a miss or a corrupt entry.
+   static bool load(U64 hash, U32 size, Vector<U8>& data);
+
+   static void store(U64 hash, const Vector<U8>& data);
+
+   /// Asks the server for the states of a datablock we didn't have cached.
+   static void requestStates(StateItemData* dataBlock);
+};
+
+//----------------------------------------------------------------------------
+
+/// Client to server: send me the compiled states of this datablock.
+class StateItemStatesRequestEvent : public NetEvent
+{
+   typedef NetEvent Parent;
+
+   SimObjectId mDataBlockId;
+
+public:
+
+   StateItemStatesRequestEvent(SimObjectId dataBlockId = 0);
+
+   void pack(NetConnection* conn, BitStream* stream);
+   void write(NetConnection* conn, BitStream* stream);
+   void unpack(NetConnection* conn, BitStream* stream);
+   void process(NetConnection* conn);
+
+   DECLARE_CONOBJECT(StateItemStatesRequestEvent);
+};
+
+/// Server to client: the compiled states of a datablock.
+class StateItemStatesEvent : public NetEvent
+{
+   typedef NetEvent Parent;
+
+   SimObjectId mDataBlockId;
+   Vector<U8> mBlob;
+
+public:
+
+   StateItemStatesEvent(StateItemData* dataBlock = NULL);
+
+   void pack(NetConnection* conn, BitStream* stream);
+   void write(NetConnection* conn, BitStream* stream);
+   void unpack(NetConnection* conn, BitStream* stream);
+   void process(NetConnection* conn);
+
+   DECLARE_CONOBJECT(StateItemStatesEvent);
+};
+
+#endif // _STATEITEMDATACACHE_H_
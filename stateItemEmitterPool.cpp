@@ -0,0 +1,208 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemEmitterPool.h"
+
+#include "T3D/StateItem.h"
+#include "T3D/fx/particleEmitter.h"
+#include "core/module.h"
+#include "platform/profiler.h"
+
+
+StateItemEmitterPool* StateItemEmitterPool::smPool = NULL;
+
+S32 StateItemEmitterPool::smMaxPerDataBlock = 16;
+
+MODULE_BEGIN( StateItemEmitterPool )
+
+   MODULE_INIT
+   {
+      StateItemEmitterPool::init();
+   }
+
+   MODULE_SHUTDOWN
+   {
+      StateItemEmitterPool::shutdown();
+   }
+
+MODULE_END;
+
+//----------------------------------------------------------------------------
+
+void StateItemEmitterPool::init()
+{
+   smPool = new StateItemEmitterPool;
+}
+
+void StateItemEmitterPool::shutdown()
+{
+   SAFE_DELETE(smPool);
+}
+
+StateItemEmitterPool::StateItemEmitterPool()
+{
+}
+
+StateItemEmitterPool::~StateItemEmitterPool()
+{
+   while (mPools.size())
+      dropPool(mPools.begin()->value);
+}
+
+void StateItemEmitterPool::Pool::onDeleteNotify(SimObject* object)
+{
+   // The emitters can't outlive their datablock, and a new datablock at
+   // the same address mustn't find them.
+   if (object == dataBlock && StateItemEmitterPool::get())
+   {
+      StateItemEmitterPool::get()->dropPool(this);
+      return;
+   }
+
+   Parent::onDeleteNotify(object);
+}
+
+StateItemEmitterPool::Pool* StateItemEmitterPool::findPool(ParticleEmitterData* dataBlock, bool create)
+{
+   PoolMap::Iterator itr = mPools.find(dataBlock);
+   if (itr != mPools.end())
+      return itr->value;
+   if (!create)
+      return NULL;
+
+   Pool* pool = new Pool;
+   pool->dataBlock = dataBlock;
+   if (!pool->registerObject())
+   {
+      delete pool;
+      return NULL;
+   }
+   pool->deleteNotify(dataBlock);
+   mPools.insertUnique(dataBlock, pool);
+   return pool;
+}
+
+void StateItemEmitterPool::dropPool(Pool* pool)
+{
+   // Owners hold their emitters by SimObjectPtr, so they let go too.
+   for (U32 i = 0; i < pool->entries.size(); i++)
+      if (pool->entries[i].emitter)
+         pool->entries[i].emitter->deleteObject();
+
+   mPools.erase(pool->dataBlock);
+   pool->deleteObject();
+}
+
+bool StateItemEmitterPool::findEntry(ParticleEmitter* emitter, Pool*& pool, U32& index)
+{
+   pool = findPool(emitter->getDataBlock(), false);
+   if (!pool)
+      return false;
+
+   for (index = 0; index < pool->entries.size(); index++)
+      if (pool->entries[index].emitter == emitter)
+         return true;
+   return false;
+}
+
+ParticleEmitter* StateItemEmitterPool::acquire(StateItem* owner, ParticleEmitterData* dataBlock)
+{
+   PROFILE_SCOPE(StateItemEmitterPool_Acquire);
+
+   Pool* pool = findPool(dataBlock, true);
+   if (!pool)
+      return NULL;
+   SimTime now = Sim::getCurrentTime();
+
+   // Take a free one if there is one, noting the least recently used
+   // on the way in case there isn't.
+   S32 lru = -1;
+   for (S32 i = pool->entries.size() - 1; i >= 0; i--)
+   {
+      Entry& entry = pool->entries[i];
+
+      // Deleted out from under us, e.g. with the rest of the client objects.
+      if (!entry.emitter)
+      {
+         pool->entries.erase_fast(i);
+         if (lru == (S32)pool->entries.size())
+            lru = i;
+         continue;
+      }
+
+      if (!entry.owner)
+      {
+         entry.owner = owner;
+         entry.lastUse = now;
+         return entry.emitter;
+      }
+
+      if (lru == -1 || entry.lastUse < pool->entries[lru].lastUse)
+         lru = i;
+   }
+
+   if (pool->entries.size() < (U32)getMax(smMaxPerDataBlock, 1))
+   {
+      ParticleEmitter* emitter = new ParticleEmitter;
+      emitter->onNewDataBlock(dataBlock, false);
+      if (!emitter->registerObject())
+      {
+         emitter->destroySelf();
+         return NULL;
+      }
+
+      Entry entry;
+      entry.emitter = emitter;
+      entry.owner = owner;
+      entry.lastUse = now;
+      pool->entries.push_back(entry);
+      return emitter;
+   }
+
+   // All in use, steal the stalest.
+   Entry& entry = pool->entries[lru];
+   entry.owner->onEmitterStolen(entry.emitter);
+   entry.owner = owner;
+   entry.lastUse = now;
+   return entry.emitter;
+}
+
+void StateItemEmitterPool::touch(ParticleEmitter* emitter)
+{
+   Pool* pool;
+   U32 index;
+   if (findEntry(emitter, pool, index))
+      pool->entries[index].lastUse = Sim::getCurrentTime();
+}
+
+void StateItemEmitterPool::release(ParticleEmitter* emitter)
+{
+   Pool* pool;
+   U32 index;
+   if (!findEntry(emitter, pool, index))
+      return;
+
+   // Over the cap, e.g. after it was lowered; let this one run dry.
+   if (pool->entries.size() > (U32)getMax(smMaxPerDataBlock, 1))
+   {
+      emitter->deleteWhenEmpty();
+      pool->entries.erase_fast(index);
+      return;
+   }
+
+   pool->entries[index].owner = NULL;
+}
+
+void StateItemEmitterPool::releaseOwner(StateItem* owner)
+{
+   for (PoolMap::Iterator itr = mPools.begin(); itr != mPools.end(); ++itr)
+   {
+      Pool* pool = itr->value;
+      for (U32 i = 0; i < pool->entries.size(); i++)
+         if (pool->entries[i].owner == owner)
+            pool->entries[i].owner = NULL;
+   }
+}
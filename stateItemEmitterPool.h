@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMEMITTERPOOL_H_
+#define _STATEITEMEMITTERPOOL_H_
+
+#ifndef _TVECTOR_H_
+   #include "core/util/tVector.h"
+#endif
+#ifndef _TDICTIONARY_H_
+   #include "core/util/tDictionary.h"
+#endif
+#ifndef _SIM_H_
+   #include "console/sim.h"
+#endif
+#ifndef _SIMOBJECT_H_
+   #include "console/simObject.h"
+#endif
+#ifndef _SIMOBJECTPTR_H_
+   #include "console/simObjectPtr.h"
+#endif
+
+class StateItem;
+class ParticleEmitter;
+class ParticleEmitterData;
+
+//----------------------------------------------------------------------------
+
+/// Hands out the particle emitters for StateItem state emitters on the client.
+///
+/// There is one pool per ParticleEmitterData.  An emitter whose state time
+/// runs out goes back to its pool still registered, and its particles keep
+/// living out their lifetimes; the next state that wants that datablock
+/// gets it back instead of a new ParticleEmitter.  Each pool holds at most
+/// smMaxPerDataBlock emitters.  When they are all in use the one used least
+/// recently is taken from its item, which stops emitting from it.
+///
+/// A pool goes, emitters and all, with its datablock, e.g. when the client
+/// disconnects.
+class StateItemEmitterPool
+{
+public:
+
+   StateItemEmitterPool();
+   ~StateItemEmitterPool();
+
+   static StateItemEmitterPool* get() { return smPool; }
+
+   static void init();
+   static void shutdown();
+
+   /// Most emitters kept per emitter datablock.
+   static S32 smMaxPerDataBlock;
+
+   /// Returns an emitter for owner, or NULL if one couldn't be created.
+   ParticleEmitter* acquire(StateItem* owner, ParticleEmitterData* dataBlock);
+
+   /// Marks the emitter used, so it is the last one stolen.
+   void touch(ParticleEmitter* emitter);
+
+   /// Gives the emitter back.  Its particles live on.
+   void release(ParticleEmitter* emitter);
+
+   /// Gives back every emitter the owner holds.
+   void releaseOwner(StateItem* owner);
+
+protected:
+
+   static StateItemEmitterPool* smPool;
+
+   struct Entry
+   {
+      SimObjectPtr<ParticleEmitter> emitter;
+      StateItem* owner;          ///< NULL when free.
+      SimTime lastUse;
+   };
+
+   /// All the emitters for one datablock.  A SimObject so it can delete
+   /// notify on the datablock.
+   class Pool : public SimObject
+   {
+      typedef SimObject Parent;
+
+   public:
+
+      ParticleEmitterData* dataBlock;
+      Vector<Entry> entries;
+
+      void onDeleteNotify(SimObject* object);
+   };
+
+   typedef HashTable<ParticleEmitterData*, Pool*> PoolMap;
+   PoolMap mPools;
+
+   Pool* findPool(ParticleEmitterData* dataBlock, bool create);
+
+   /// Deletes the pool and every emitter in it.
+   void dropPool(Pool* pool);
+
+   /// Finds the entry holding emitter, returns false if there is none.
+   bool findEntry(ParticleEmitter* emitter, Pool*& pool, U32& index);
+};
+
+#endif // _STATEITEMEMITTERPOOL_H_
@@ -0,0 +1,153 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemLights.h"
+
+#include "T3D/StateItem.h"
+#include "core/module.h"
+#include "math/mSphere.h"
+#include "platform/profiler.h"
+#include "scene/sceneManager.h"
+#include "scene/sceneRenderState.h"
+
+
+StateItemLightBudget* StateItemLightBudget::smBudget = NULL;
+
+S32 StateItemLightBudget::smMaxLights = 8;
+F32 StateItemLightBudget::smMaxDistance = 150.0f;
+
+MODULE_BEGIN( StateItemLightBudget )
+
+   MODULE_INIT
+   {
+      StateItemLightBudget::init();
+   }
+
+   MODULE_SHUTDOWN
+   {
+      StateItemLightBudget::shutdown();
+   }
+
+MODULE_END;
+
+//----------------------------------------------------------------------------
+
+void StateItemLightBudget::init()
+{
+   smBudget = new StateItemLightBudget;
+}
+
+void StateItemLightBudget::shutdown()
+{
+   SAFE_DELETE(smBudget);
+}
+
+StateItemLightBudget::StateItemLightBudget()
+{
+   SceneManager::getPreRenderSignal().notify( this, &StateItemLightBudget::_onPreRender );
+}
+
+StateItemLightBudget::~StateItemLightBudget()
+{
+   SceneManager::getPreRenderSignal().remove( this, &StateItemLightBudget::_onPreRender );
+
+   for (U32 i = 0; i < mItems.size(); i++)
+      mItems[i]->mLightAdmitted = false;
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemLightBudget::addItem(StateItem* item)
+{
+   if (!mItems.contains(item))
+      mItems.push_back(item);
+}
+
+void StateItemLightBudget::removeItem(StateItem* item)
+{
+   item->mLightAdmitted = false;
+
+   for (U32 i = 0; i < mItems.size(); i++)
+      if (mItems[i] == item)
+      {
+         mItems.erase_fast(i);
+         break;
+      }
+   for (U32 i = 0; i < mAdmitted.size(); i++)
+      if (mAdmitted[i] == item)
+      {
+         mAdmitted.erase(i);
+         break;
+      }
+}
+
+S32 QSORT_CALLBACK StateItemLightBudget::_compareCandidate(const void* a, const void* b)
+{
+   const Candidate* ca = (const Candidate*)a;
+   const Candidate* cb = (const Candidate*)b;
+   if (ca->score != cb->score)
+      return ca->score > cb->score ? -1 : 1;
+   return S32(ca->item->getId()) - S32(cb->item->getId());
+}
+
+void StateItemLightBudget::_onPreRender(SceneManager* sceneManager, const SceneRenderState* state)
+{
+   if (!state->isDiffusePass())
+      return;
+
+   PROFILE_SCOPE(StateItemLightBudget_Gather);
+
+#ifdef STATEITEM_PROFILE
+   mPrevious = mAdmitted;
+#endif
+   for (U32 i = 0; i < mAdmitted.size(); i++)
+      mAdmitted[i]->mLightAdmitted = false;
+   mAdmitted.clear();
+   mCandidates.clear();
+
+   const Frustum& frustum = state->getCullingFrustum();
+   const Point3F& camPos = state->getCameraPosition();
+
+   for (U32 i = 0; i < mItems.size(); i++)
+   {
+      StateItem* item = mItems[i];
+      if (item->isHidden())
+         continue;
+
+      // Cheapest tests first, the intensity may take a sine.
+      F32 radius = item->mDataBlock->lightRadius;
+      Point3F pos = item->getRenderPosition();
+      F32 distSq = (pos - camPos).lenSquared();
+      F32 maxDist = smMaxDistance + radius;
+      if (distSq > maxDist * maxDist)
+         continue;
+      if (frustum.isCulled(SphereF(pos, radius)))
+         continue;
+
+      F32 intensity = item->getLightIntensity();
+      if (intensity <= 0.0f)
+         continue;
+
+      Candidate candidate;
+      candidate.item = item;
+      candidate.score = intensity * radius * radius / getMax(distSq, 1.0f);
+      mCandidates.push_back(candidate);
+   }
+
+   dQsort(mCandidates.address(), mCandidates.size(), sizeof(Candidate), _compareCandidate);
+
+   U32 count = getMin(mCandidates.size(), (U32)getMax(smMaxLights, 0));
+   mAdmitted.setSize(count);
+   for (U32 i = 0; i < count; i++)
+   {
+      mAdmitted[i] = mCandidates[i].item;
+      mAdmitted[i]->mLightAdmitted = true;
+#ifdef STATEITEM_PROFILE
+      if (!mPrevious.contains(mAdmitted[i]))
+         STATEITEM_PROFILE_SPAWN(mAdmitted[i], LightSpawn);
+#endif
+   }
+}
@@ -0,0 +1,81 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMLIGHTS_H_
+#define _STATEITEMLIGHTS_H_
+
+#ifndef _TVECTOR_H_
+   #include "core/util/tVector.h"
+#endif
+#ifndef _StateItem_H_
+   #include "T3D/StateItem.h"
+#endif
+
+class SceneManager;
+class SceneRenderState;
+
+//----------------------------------------------------------------------------
+
+/// Decides which client StateItem lights are worth registering.
+///
+/// Once per diffuse render the lit items are culled against the view
+/// frustum and smMaxDistance, ranked by how much of the screen they light,
+/// and only the best smMaxLights are admitted.  The rank is the light's
+/// intensity times its radius squared over its distance squared, a stand
+/// in for its projected size.  Admitted items register their light from
+/// StateItem::submitLights as before; the rest register nothing, so a
+/// room full of glowing pickups costs at most smMaxLights lights.
+///
+/// The light manager registers lights before the pre render signal, so
+/// admissions lag the camera by a frame.
+class StateItemLightBudget
+{
+public:
+
+   StateItemLightBudget();
+   ~StateItemLightBudget();
+
+   static StateItemLightBudget* get() { return smBudget; }
+
+   static void init();
+   static void shutdown();
+
+   /// Most StateItem lights admitted at once.
+   static S32 smMaxLights;
+
+   /// Lights whose sphere is farther than this from the camera are culled.
+   static F32 smMaxDistance;
+
+   /// Client side, items whose datablock has a light.
+   void addItem(StateItem* item);
+   void removeItem(StateItem* item);
+
+   /// The items admitted this frame, brightest on screen first.
+   const Vector<StateItem*>& getAdmitted() const { return mAdmitted; }
+
+protected:
+
+   static StateItemLightBudget* smBudget;
+
+   struct Candidate
+   {
+      StateItem* item;
+      F32 score;
+   };
+
+   Vector<StateItem*> mItems;
+   Vector<Candidate> mCandidates;
+   Vector<StateItem*> mAdmitted;
+#ifdef STATEITEM_PROFILE
+   Vector<StateItem*> mPrevious;    ///< Last frame's, for counting new lights.
+#endif
+
+   static S32 QSORT_CALLBACK _compareCandidate(const void* a, const void* b);
+
+   /// Hooked to the scene pre render signal.
+   void _onPreRender(SceneManager* sceneManager, const SceneRenderState* state);
+};
+
+#endif // _STATEITEMLIGHTS_H_
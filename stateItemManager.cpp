@@ -0,0 +1,1022 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemManager.h"
+
+#include "T3D/StateItem.h"
+#include "T3D/stateItemRecorder.h"
+#include "T3D/stateItemVoicePool.h"
+#include "T3D/gameBase/gameProcess.h"
+#include "core/module.h"
+#include "platform/profiler.h"
+#include "platform/platformIntrinsics.h"
+#include "platform/threads/threadPool.h"
+#include "scene/sceneManager.h"
+
+
+StateItemManager* StateItemManager::smServer = NULL;
+StateItemManager* StateItemManager::smClient = NULL;
+
+S32 StateItemManager::smParallelThreshold = 256;
+S32 StateItemManager::smChunkSize = 64;
+F32 StateItemManager::smBroadphaseCellSize = 16.0f;
+
+MODULE_BEGIN( StateItemManager )
+
+   MODULE_INIT_AFTER( ProcessList )
+   MODULE_SHUTDOWN_BEFORE( ProcessList )
+
+   MODULE_INIT
+   {
+      StateItemManager::init();
+   }
+
+   MODULE_SHUTDOWN
+   {
+      StateItemManager::shutdown();
+   }
+
+MODULE_END;
+
+//----------------------------------------------------------------------------
+
+template<class T>
+static inline void swapElem(T& a, T& b)
+{
+   T tmp = a;
+   a = b;
+   b = tmp;
+}
+
+StateItemManager::Batch::Batch(StateItemData* db)
+{
+   dataBlock = db;
+   activeCount = 0;
+   dirty = false;
+}
+
+U32 StateItemManager::Batch::add(StateItem* item)
+{
+   items.push_back(item);
+   delayTime.push_back(0.0f);
+   remainingDt.push_back(0.0f);
+   stateIndex.push_back(-1);
+   inputs.push_back(0);
+   fireCount.push_back(0);
+
+   // Swap in front of the sleepers.
+   U32 slot = items.size() - 1;
+   if (slot != activeCount)
+   {
+      swapSlots(slot, activeCount);
+      slot = activeCount;
+   }
+   activeCount++;
+   return slot;
+}
+
+void StateItemManager::Batch::copySlot(U32 from, U32 to)
+{
+   if (from == to)
+      return;
+   items[to] = items[from];
+   delayTime[to] = delayTime[from];
+   remainingDt[to] = remainingDt[from];
+   stateIndex[to] = stateIndex[from];
+   inputs[to] = inputs[from];
+   fireCount[to] = fireCount[from];
+   if (items[to])
+      items[to]->mBatchSlot = to;
+}
+
+void StateItemManager::Batch::swapSlots(U32 a, U32 b)
+{
+   if (a == b)
+      return;
+   swapElem(items[a], items[b]);
+   swapElem(delayTime[a], delayTime[b]);
+   swapElem(remainingDt[a], remainingDt[b]);
+   swapElem(stateIndex[a], stateIndex[b]);
+   swapElem(inputs[a], inputs[b]);
+   swapElem(fireCount[a], fireCount[b]);
+   if (items[a])
+      items[a]->mBatchSlot = a;
+   if (items[b])
+      items[b]->mBatchSlot = b;
+}
+
+void StateItemManager::Batch::remove(U32 slot)
+{
+   // Close the gap in the awake range with its last item, then fill
+   // that with the last item overall.
+   if (slot < activeCount)
+   {
+      activeCount--;
+      copySlot(activeCount, slot);
+      slot = activeCount;
+   }
+   copySlot(items.size() - 1, slot);
+
+   items.pop_back();
+   delayTime.pop_back();
+   remainingDt.pop_back();
+   stateIndex.pop_back();
+   inputs.pop_back();
+   fireCount.pop_back();
+}
+
+void StateItemManager::Batch::compact()
+{
+   // Walk backwards so every slot we move into has already been checked.
+   // remove() only ever pulls from slots above the one it frees.
+   for (S32 i = items.size() - 1; i >= 0; i--)
+      if (!items[i])
+         remove(i);
+   dirty = false;
+}
+
+//----------------------------------------------------------------------------
+
+/// Phase one helper run on the global thread pool.
+class StateItemEvalWorkItem : public ThreadPool::WorkItem
+{
+   typedef ThreadPool::WorkItem Parent;
+
+   StateItemManager* mManager;
+   F32 mDt;
+   U32 mSequence;
+
+public:
+
+   StateItemEvalWorkItem(StateItemManager* manager, F32 dt)
+      : mManager(manager), mDt(dt), mSequence(manager->getHelperSequence()) {}
+
+protected:
+
+   virtual void execute()
+   {
+      if (!mManager->startHelper(mSequence))
+         return;
+      mManager->evaluateChunks(mDt);
+      mManager->mWorkDone.release();
+   }
+};
+
+/// Physics stage helper run on the global thread pool.
+class StateItemSweepWorkItem : public ThreadPool::WorkItem
+{
+   typedef ThreadPool::WorkItem Parent;
+
+   StateItemManager* mManager;
+   F32 mDt;
+   StateItemCollisionScratch* mScratch;
+   U32 mSequence;
+
+public:
+
+   StateItemSweepWorkItem(StateItemManager* manager, F32 dt, StateItemCollisionScratch* scratch)
+      : mManager(manager), mDt(dt), mScratch(scratch), mSequence(manager->getHelperSequence()) {}
+
+protected:
+
+   virtual void execute()
+   {
+      if (!mManager->startHelper(mSequence))
+         return;
+      mManager->sweepMoving(mDt, *mScratch);
+      mManager->mWorkDone.release();
+   }
+};
+
+//----------------------------------------------------------------------------
+
+StateItemManager::StateItemManager(bool isServer)
+   : mWorkDone(0)
+{
+   mIsServer = isServer;
+   mTicking = false;
+   mTimeAccum = 0;
+   mNextChunk = 0;
+   mHelperState = 0;
+   mFirstUntraced = 0;
+   mMountOrderDirty = false;
+   mMountsStale = false;
+   mVoicesStale = false;
+   mMountDt = 0.0f;
+
+   if (mIsServer)
+      ServerProcessList::get()->postTickSignal().notify( this, &StateItemManager::_onPostTick );
+   else
+   {
+      ClientProcessList::get()->postTickSignal().notify( this, &StateItemManager::_onPostTick );
+      SceneManager::getPreRenderSignal().notify( this, &StateItemManager::_onPreRender );
+   }
+}
+
+StateItemManager::~StateItemManager()
+{
+   if (mIsServer)
+      ServerProcessList::get()->postTickSignal().remove( this, &StateItemManager::_onPostTick );
+   else
+   {
+      ClientProcessList::get()->postTickSignal().remove( this, &StateItemManager::_onPostTick );
+      SceneManager::getPreRenderSignal().remove( this, &StateItemManager::_onPreRender );
+   }
+
+   // Helpers that never got to start may still be queued with a pointer
+   // to us.
+   ThreadPool::GLOBAL().flushWorkItems();
+
+   for (U32 i = 0; i < mBatches.size(); i++)
+   {
+      Batch* batch = mBatches[i];
+      for (U32 j = 0; j < batch->size(); j++)
+         if (batch->items[j])
+            batch->items[j]->mBatch = NULL;
+      delete batch;
+   }
+
+   for (U32 i = 0; i < mScratch.size(); i++)
+      delete mScratch[i];
+}
+
+void StateItemManager::init()
+{
+   smServer = new StateItemManager(true);
+   smClient = new StateItemManager(false);
+}
+
+void StateItemManager::shutdown()
+{
+   SAFE_DELETE(smServer);
+   SAFE_DELETE(smClient);
+}
+
+StateItemManager::Batch* StateItemManager::findOrCreateBatch(StateItemData* db)
+{
+   BatchMap::Iterator itr = mBatchMap.find(db);
+   if (itr != mBatchMap.end())
+      return itr->value;
+
+   Batch* batch = new Batch(db);
+   mBatchMap.insertUnique(db, batch);
+   mBatches.push_back(batch);
+   return batch;
+}
+
+void StateItemManager::addItem(StateItem* item)
+{
+   Batch* batch = findOrCreateBatch(item->mDataBlock);
+   if (item->mBatch == batch)
+      return;
+
+   U32 slot = batch->add(item);
+
+   // Switching datablocks keeps the flags, but the old state index means
+   // nothing to the new datablock.
+   if (item->mBatch)
+   {
+      batch->inputs[slot] = item->mBatch->inputs[item->mBatchSlot];
+      batch->fireCount[slot] = item->mBatch->fireCount[item->mBatchSlot];
+      removeItem(item);
+   }
+
+   item->mBatch = batch;
+   item->mBatchSlot = slot;
+}
+
+void StateItemManager::removeItem(StateItem* item)
+{
+   Batch* batch = item->mBatch;
+   if (!batch)
+      return;
+
+   for (U32 i = 0; i < mPendingWake.size(); i++)
+      if (mPendingWake[i] == item)
+      {
+         mPendingWake.erase_fast(i);
+         break;
+      }
+   if (item->mSleeping && mIsServer)
+      item->setProcessTick(true);
+   item->mSleeping = false;
+
+   // Don't move slots around under the tick loop, just free this one.
+   if (mTicking)
+   {
+      batch->items[item->mBatchSlot] = NULL;
+      batch->dirty = true;
+   }
+   else
+      batch->remove(item->mBatchSlot);
+
+   item->mBatch = NULL;
+   item->mBatchSlot = 0;
+}
+
+void StateItemManager::resetStates(StateItemData* dataBlock)
+{
+   BatchMap::Iterator itr = mBatchMap.find(dataBlock);
+   if (itr == mBatchMap.end())
+      return;
+
+   // setState wakes items, which moves slots, so collect them first.
+   Batch* batch = itr->value;
+   Vector<StateItem*> items;
+   Vector<S32> states;
+   for (U32 i = 0; i < batch->size(); i++)
+      if (batch->items[i])
+      {
+         items.push_back(batch->items[i]);
+         states.push_back(batch->stateIndex[i]);
+      }
+
+   for (U32 i = 0; i < items.size(); i++)
+      items[i]->setState(getMax(states[i], 0), true);
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemManager::_onPostTick(SimTime elapsedMs)
+{
+   if (!mInputQueue.isEmpty())
+      drainInputs();
+
+   // Objects advanced, their voices move before the next render.
+   if (!mIsServer)
+      mVoicesStale = true;
+
+   mTimeAccum += elapsedMs;
+   if (mTimeAccum < TickMs)
+      return;
+
+   PROFILE_SCOPE(StateItemManager_Tick);
+
+   mTicking = true;
+   for (; mTimeAccum >= TickMs; mTimeAccum -= TickMs)
+   {
+      if (mIsServer)
+         StateItemRecorder::onTick();
+      updatePhysics(TickSec);
+      tick(TickSec);
+   }
+   mTicking = false;
+
+   for (U32 i = 0; i < mBatches.size(); i++)
+      if (mBatches[i]->dirty)
+         mBatches[i]->compact();
+
+   updateSleeping();
+}
+
+void StateItemManager::drainInputs()
+{
+   PROFILE_SCOPE(StateItemManager_DrainInputs);
+
+   InputCommand command;
+   while (mInputQueue.tryPopFront(command))
+   {
+      StateItem* item;
+      if (!Sim::findObject(command.id, item))
+         continue;
+
+      // We are on the main thread, so these apply directly.
+      switch (command.type)
+      {
+         case TriggerCommand:          item->setTriggerState(command.value); break;
+         case AltTriggerCommand:       item->setAltTriggerState(command.value); break;
+         case AmmoCommand:             item->setAmmoState(command.value); break;
+         case WetCommand:              item->setWetState(command.value); break;
+         case MotionCommand:           item->setMotionState(command.value); break;
+         case TargetCommand:           item->setTargetState(command.value); break;
+         case LoadedCommand:           item->setLoadedState(command.value); break;
+         case GenericTriggerCommand:   item->setGenericTriggerState(command.trigger, command.value); break;
+      }
+   }
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemManager::addMounted(StateItem* item)
+{
+   if (!mMounted.contains(item))
+      mMounted.push_back(item);
+   mMountOrderDirty = true;
+}
+
+void StateItemManager::removeMounted(StateItem* item)
+{
+   // Removing keeps the order, nothing to resort.
+   for (U32 i = 0; i < mMounted.size(); i++)
+      if (mMounted[i] == item)
+      {
+         mMounted.erase(i);
+         break;
+      }
+}
+
+U32 StateItemManager::getMountDepth(StateItem* item)
+{
+   // Bounded in case of a mount cycle.
+   U32 depth = 0;
+   SceneObject* mount = item->getObjectMount();
+   while (mount && depth < 32)
+   {
+      StateItem* parent = dynamic_cast<StateItem*>(mount);
+      if (!parent)
+         break;
+      depth++;
+      mount = parent->getObjectMount();
+   }
+   return depth;
+}
+
+struct MountOrder
+{
+   StateItem* item;
+   U32 depth;
+};
+
+static S32 QSORT_CALLBACK _compareMountOrder(const void* a, const void* b)
+{
+   const MountOrder* ma = (const MountOrder*)a;
+   const MountOrder* mb = (const MountOrder*)b;
+   if (ma->depth != mb->depth)
+      return ma->depth < mb->depth ? -1 : 1;
+   return S32(ma->item->getId()) - S32(mb->item->getId());
+}
+
+void StateItemManager::sortMounted()
+{
+   Vector<MountOrder> order;
+   order.setSize(mMounted.size());
+   for (U32 i = 0; i < mMounted.size(); i++)
+   {
+      order[i].item = mMounted[i];
+      order[i].depth = getMountDepth(mMounted[i]);
+   }
+   dQsort(order.address(), order.size(), sizeof(MountOrder), _compareMountOrder);
+
+   for (U32 i = 0; i < order.size(); i++)
+      mMounted[i] = order[i].item;
+   mMountOrderDirty = false;
+}
+
+void StateItemManager::_onPreRender(SceneManager* sceneManager, const SceneRenderState* state)
+{
+   // Once per frame, reflections and the like render again.
+   if (mMountsStale)
+   {
+      mMountsStale = false;
+
+      PROFILE_SCOPE(StateItemManager_MountPass);
+
+      if (mMountOrderDirty)
+         sortMounted();
+
+      for (U32 i = 0; i < mMounted.size(); i++)
+         if (mMounted[i]->isMounted())
+            mMounted[i]->updateMountTransform(mMountDt);
+   }
+
+   // After the mount pass, so voices of mounted items don't lag a frame.
+   if (mVoicesStale)
+   {
+      mVoicesStale = false;
+      StateItemVoicePool::get()->updateVoices();
+   }
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemManager::sleepItem(StateItem* item)
+{
+   Batch* batch = item->mBatch;
+   if (!batch || item->mSleeping || mTicking)
+      return;
+
+   batch->activeCount--;
+   batch->swapSlots(item->mBatchSlot, batch->activeCount);
+   item->mSleeping = true;
+
+   if (mIsServer)
+      item->setProcessTick(false);
+}
+
+void StateItemManager::wakeItem(StateItem* item)
+{
+   Batch* batch = item->mBatch;
+   if (!batch || !item->mSleeping)
+      return;
+
+   // Let the object tick again right away, the slot can wait.
+   if (mIsServer)
+      item->setProcessTick(true);
+
+   if (mTicking)
+   {
+      if (!mPendingWake.contains(item))
+         mPendingWake.push_back(item);
+      return;
+   }
+
+   batch->swapSlots(item->mBatchSlot, batch->activeCount);
+   batch->activeCount++;
+   item->mSleeping = false;
+}
+
+void StateItemManager::updateSleeping()
+{
+   PROFILE_SCOPE(StateItemManager_UpdateSleeping);
+
+   for (U32 i = 0; i < mPendingWake.size(); i++)
+      wakeItem(mPendingWake[i]);
+   mPendingWake.clear();
+
+   for (U32 i = 0; i < mBatches.size(); i++)
+   {
+      Batch& batch = *mBatches[i];
+      if (needsItemUpdate(batch))
+         continue;
+
+      // Backwards, so the item swapped into slot j was already checked.
+      for (S32 j = batch.activeCount - 1; j >= 0; j--)
+         if (batch.items[j]->canSleep())
+            sleepItem(batch.items[j]);
+   }
+}
+
+U32 StateItemManager::getHelperCount(U32 itemCount, U32 chunkCount)
+{
+   if (itemCount < (U32)smParallelThreshold || chunkCount < 2)
+      return 0;
+   // The started count in mHelperState has 8 bits.
+   return getMin(getMin(ThreadPool::GLOBAL().getNumThreads(), chunkCount - 1), 255U);
+}
+
+bool StateItemManager::startHelper(U32 sequence)
+{
+   for (;;)
+   {
+      U32 state = mHelperState;
+      if ((state >> 8) != sequence)
+         return false;
+      if (dCompareAndSwap(mHelperState, state, state + 1))
+         return true;
+   }
+}
+
+void StateItemManager::finishHelpers()
+{
+   // Moving to the next sequence and reading the started count are one
+   // swap, so no helper can start in between.
+   U32 state;
+   do
+   {
+      state = mHelperState;
+   } while (!dCompareAndSwap(mHelperState, state, ((state >> 8) + 1) << 8));
+
+   for (U32 i = 0; i < (state & 0xff); i++)
+      mWorkDone.acquire();
+}
+
+bool StateItemManager::needsItemUpdate(const Batch& batch)
+{
+   return batch.dataBlock->usesEnergy || batch.dataBlock->useRemainderDT;
+}
+
+void StateItemManager::tick(F32 dt)
+{
+   // Phase one: timers and transition choice.
+   mChunks.clear();
+   U32 count = 0;
+   U32 chunkSize = getMax(smChunkSize, 1);
+   for (U32 i = 0; i < mBatches.size(); i++)
+   {
+      Batch* batch = mBatches[i];
+      // No states to run until the server sends them.
+      if (!batch->activeCount || needsItemUpdate(*batch) || batch->dataBlock->mStatesPending)
+         continue;
+
+      batch->nextState.setSize(batch->activeCount);
+      for (U32 start = 0; start < batch->activeCount; start += chunkSize)
+      {
+         EvalChunk chunk;
+         chunk.batch = batch;
+         chunk.start = start;
+         chunk.end = getMin(start + chunkSize, batch->activeCount);
+         mChunks.push_back(chunk);
+      }
+      count += batch->activeCount;
+   }
+
+   mNextChunk = 0;
+   U32 workers = getHelperCount(count, mChunks.size());
+   for (U32 i = 0; i < workers; i++)
+      ThreadPool::GLOBAL().queueWorkItem(new StateItemEvalWorkItem(this, dt));
+
+   // The main thread takes chunks too, then waits for the helpers that
+   // got going; the rest find nothing to do.
+   evaluateChunks(dt);
+   finishHelpers();
+
+   // Phase two: side effects, one thread.
+   applyTransitions();
+
+   for (U32 i = 0; i < mBatches.size(); i++)
+   {
+      Batch& batch = *mBatches[i];
+      if (!batch.activeCount || batch.dataBlock->mStatesPending)
+         continue;
+
+      if (needsItemUpdate(batch))
+      {
+         for (U32 j = 0; j < batch.activeCount; j++)
+            if (batch.items[j])
+               batch.items[j]->updateState(dt);
+         continue;
+      }
+
+      // Spin timeScale follows delayTime, so it has to see the result of
+      // the transitions above.
+      for (U32 j = 0; j < batch.activeCount; j++)
+      {
+         S32 si = batch.stateIndex[j];
+         if (!batch.items[j] || si < 0)
+            continue;
+         const StateItemData::StateData& stateData = batch.dataBlock->state[si];
+         if (stateData.spin == StateItemData::StateData::SpinUp ||
+             stateData.spin == StateItemData::StateData::SpinDown)
+            batch.items[j]->updateSpinThread(stateData);
+      }
+   }
+}
+
+void StateItemManager::evaluateChunks(F32 dt)
+{
+   for (;;)
+   {
+      U32 index = dFetchAndAdd(mNextChunk, 1);
+      if (index >= mChunks.size())
+         break;
+      evaluateChunk(mChunks[index], dt);
+   }
+}
+
+void StateItemManager::evaluateChunk(const EvalChunk& chunk, F32 dt)
+{
+   Batch& batch = *chunk.batch;
+   const StateItemData* db = batch.dataBlock;
+
+   // This is the pure part of StateItem::updateState.  It may only
+   // write slot i, and must not touch the item itself.
+   for (U32 i = chunk.start; i < chunk.end; i++)
+   {
+      batch.nextState[i] = -1;
+
+      S32 si = batch.stateIndex[i];
+      if (!batch.items[i] || si < 0)
+         continue;
+
+      const StateItemData::StateData& stateData = db->state[si];
+
+      F32 delay = batch.delayTime[i];
+      F32 elapsed = (delay > dt) ? dt : delay;
+      delay -= elapsed;
+      batch.delayTime[i] = delay;
+      batch.remainingDt[i] = dt - elapsed;
+
+      if (delay <= 0 || !stateData.waitForTimeout)
+      {
+         S32 ns = db->lookupTransition(si, batch.inputs[i]);
+         if (ns == -1 && delay <= 0)
+            ns = stateData.transition.timeout;
+         batch.nextState[i] = ns;
+      }
+   }
+}
+
+S32 QSORT_CALLBACK StateItemManager::_comparePending(const void* a, const void* b)
+{
+   SimObjectId idA = ((const StateItemManager::PendingTransition*)a)->id;
+   SimObjectId idB = ((const StateItemManager::PendingTransition*)b)->id;
+   return (idA < idB) ? -1 : ((idA > idB) ? 1 : 0);
+}
+
+void StateItemManager::applyTransitions()
+{
+   mPending.clear();
+   for (U32 i = 0; i < mChunks.size(); i++)
+   {
+      const EvalChunk& chunk = mChunks[i];
+      Batch& batch = *chunk.batch;
+      for (U32 j = chunk.start; j < chunk.end; j++)
+      {
+         if (batch.nextState[j] == -1)
+            continue;
+
+         PendingTransition pt;
+         pt.item = batch.items[j];
+         pt.id = pt.item->getId();
+         pt.batch = &batch;
+         pt.slot = j;
+         pt.fromState = batch.stateIndex[j];
+         pt.toState = batch.nextState[j];
+         mPending.push_back(pt);
+      }
+   }
+
+   if (mPending.size() > 1)
+      dQsort(mPending.address(), mPending.size(), sizeof(PendingTransition), _comparePending);
+
+   // The fire callbacks ask for the muzzle vector, trace those rays together.
+   for (U32 i = 0; i < mPending.size(); i++)
+   {
+      const StateItemData::StateData& toState = mPending[i].batch->dataBlock->state[mPending[i].toState];
+      if (toState.fire || toState.altFire)
+         submitAimRay(mPending[i].item);
+   }
+   traceSubmittedAimRays();
+
+   for (U32 i = 0; i < mPending.size(); i++)
+   {
+      const PendingTransition& pt = mPending[i];
+
+      // An earlier callback may have deleted the item or moved it to
+      // another state already; it gets re-evaluated next tick.
+      if (pt.batch->items[pt.slot] != pt.item || pt.batch->stateIndex[pt.slot] != pt.fromState)
+         continue;
+
+      pt.item->setState(pt.toState);
+   }
+}
+
+//----------------------------------------------------------------------------
+
+void StateItemManager::updatePhysics(F32 dt)
+{
+   mMoving.clear();
+   for (U32 i = 0; i < mBatches.size(); i++)
+   {
+      Batch* batch = mBatches[i];
+      for (U32 j = 0; j < batch->activeCount; j++)
+      {
+         StateItem* item = batch->items[j];
+         if (item && item->isMoving())
+         {
+            MovingItem mi;
+            mi.batch = batch;
+            mi.slot = j;
+            mMoving.push_back(mi);
+         }
+      }
+   }
+
+   if (mMoving.empty())
+      return;
+
+   PROFILE_SCOPE(StateItemManager_UpdatePhysics);
+
+   mQueries.clear();
+   for (U32 i = 0; i < mMoving.size(); i++)
+   {
+      StateItem* item = mMoving[i].batch->items[mMoving[i].slot];
+      item->updateVelocity(dt);
+      if (!item->updateWorkingQueryBox(dt))
+         continue;
+
+      BroadphaseQuery query;
+      query.cell = getCellKey(item->mWorkingQueryBox.getCenter());
+      query.moving = i;
+      mQueries.push_back(query);
+   }
+
+   if (!mQueries.empty())
+      updateBroadphase();
+
+   for (U32 i = 0; i < mMoving.size(); i++)
+      mMoving[i].batch->items[mMoving[i].slot]->beginMove(dt);
+
+   // Sweep on the pool.  Nothing above runs script, so every item is
+   // still there.
+   {
+      PROFILE_SCOPE(StateItemManager_SweepMoving);
+
+      U32 chunkSize = getMax(smChunkSize, 1);
+      U32 chunks = (mMoving.size() + chunkSize - 1) / chunkSize;
+      U32 workers = getHelperCount(mMoving.size(), chunks);
+      while (mScratch.size() < workers + 1)
+         mScratch.push_back(new StateItemCollisionScratch);
+
+      mNextChunk = 0;
+      for (U32 i = 0; i < workers; i++)
+         ThreadPool::GLOBAL().queueWorkItem(new StateItemSweepWorkItem(this, dt, mScratch[i + 1]));
+
+      sweepMoving(dt, *mScratch[0]);
+      finishHelpers();
+   }
+
+   // Script run from the collision callbacks can delete items.
+   for (U32 i = 0; i < mMoving.size(); i++)
+   {
+      StateItem* item = mMoving[i].batch->items[mMoving[i].slot];
+      if (item)
+         item->endMove(dt);
+   }
+}
+
+void StateItemManager::sweepMoving(F32 dt, StateItemCollisionScratch& scratch)
+{
+   U32 chunkSize = getMax(smChunkSize, 1);
+   for (;;)
+   {
+      U32 start = dFetchAndAdd(mNextChunk, 1) * chunkSize;
+      if (start >= mMoving.size())
+         break;
+
+      U32 end = getMin(start + chunkSize, mMoving.size());
+      for (U32 i = start; i < end; i++)
+         mMoving[i].batch->items[mMoving[i].slot]->sweepMove(scratch, dt);
+   }
+}
+
+S32 QSORT_CALLBACK StateItemManager::_compareQuery(const void* a, const void* b)
+{
+   U64 cellA = ((const BroadphaseQuery*)a)->cell;
+   U64 cellB = ((const BroadphaseQuery*)b)->cell;
+   return (cellA < cellB) ? -1 : ((cellA > cellB) ? 1 : 0);
+}
+
+void StateItemManager::updateBroadphase()
+{
+   PROFILE_SCOPE(StateItemManager_UpdateBroadphase);
+
+   if (mQueries.size() > 1)
+      dQsort(mQueries.address(), mQueries.size(), sizeof(BroadphaseQuery), _compareQuery);
+
+   StateItem* first = mMoving[mQueries[0].moving].batch->items[mMoving[mQueries[0].moving].slot];
+   SceneContainer* container = first->getContainer();
+   U32 mask = first->getCollisionMask();
+
+   for (U32 start = 0; start < mQueries.size(); )
+   {
+      // Everyone in this cell shares one query over the union of their boxes.
+      U32 end = start;
+      Box3F cellBox = mMoving[mQueries[start].moving].batch->items[mMoving[mQueries[start].moving].slot]->mWorkingQueryBox;
+      while (end < mQueries.size() && mQueries[end].cell == mQueries[start].cell)
+      {
+         const MovingItem& mi = mMoving[mQueries[end].moving];
+         const Box3F& queryBox = mi.batch->items[mi.slot]->mWorkingQueryBox;
+         cellBox.minExtents.setMin(queryBox.minExtents);
+         cellBox.maxExtents.setMax(queryBox.maxExtents);
+         end++;
+      }
+
+      mCandidates.mList.clear();
+      container->findObjects(cellBox, mask, SimpleQueryList::insertionCallback, &mCandidates);
+
+      for (U32 i = start; i < end; i++)
+      {
+         const MovingItem& mi = mMoving[mQueries[i].moving];
+         mi.batch->items[mi.slot]->updateWorkingCollisionSet(mCandidates.mList);
+      }
+
+      start = end;
+   }
+}
+
+//----------------------------------------------------------------------------
+
+U64 StateItemManager::getCellKey(const Point3F& pos)
+{
+   // 21 bits a side covers +/- 16 million meters at the default size.
+   Point3F cell = pos / getMax(smBroadphaseCellSize, 1.0f);
+   return ((U64)((S32)mFloor(cell.x) & 0x1FFFFF) << 42) |
+          ((U64)((S32)mFloor(cell.y) & 0x1FFFFF) << 21) |
+           (U64)((S32)mFloor(cell.z) & 0x1FFFFF);
+}
+
+ProcessList* StateItemManager::getProcessList() const
+{
+   if (mIsServer)
+      return ServerProcessList::get();
+   return ClientProcessList::get();
+}
+
+void StateItemManager::pruneAimRays(U32 tick)
+{
+   // Oldest first, so stop at the first one from this tick.
+   U32 count = 0;
+   while (count < mAimRays.size() && mAimRays[count].tick != tick)
+      count++;
+   if (!count)
+      return;
+
+   mAimRays.erase(0, count);
+   mFirstUntraced = (mFirstUntraced > count) ? mFirstUntraced - count : 0;
+}
+
+void StateItemManager::castAimRay(AimRay& ray)
+{
+   PROFILE_SCOPE(StateItemManager_CastAimRay);
+
+   RayInfo rinfo;
+   ray.owner->disableCollision();
+   ray.hit = ray.owner->getContainer()->castRay(ray.start, ray.end, STATIC_COLLISION_TYPEMASK|DAMAGEABLE_TYPEMASK, &rinfo);
+   ray.owner->enableCollision();
+
+   ray.point = ray.hit ? rinfo.point : ray.end;
+   ray.item = NULL;
+}
+
+bool StateItemManager::traceAimRay(StateItem* item, const Point3F& start, const Point3F& end, Point3F* hitPoint)
+{
+   GameConnection* conn = item->getControllingClient();
+   U32 tick = getProcessList()->getTotalTicks();
+   pruneAimRays(tick);
+
+   for (U32 i = 0; i < mAimRays.size(); i++)
+   {
+      AimRay& ray = mAimRays[i];
+      if (ray.conn != conn || ray.owner != item || ray.start != start || ray.end != end)
+         continue;
+
+      if (ray.item)
+         castAimRay(ray);
+      *hitPoint = ray.point;
+      return ray.hit;
+   }
+
+   // Keep the untraced ones last.
+   AimRay ray;
+   ray.conn = conn;
+   ray.tick = tick;
+   ray.cell = 0;
+   ray.start = start;
+   ray.end = end;
+   ray.owner = item;
+   ray.item = item;
+   castAimRay(ray);
+   mAimRays.insert(mFirstUntraced, ray);
+   mFirstUntraced++;
+
+   *hitPoint = ray.point;
+   return ray.hit;
+}
+
+void StateItemManager::submitAimRay(StateItem* item)
+{
+   if (!item->usesCorrectedAim())
+      return;
+
+   Point3F start, end;
+   item->getAimRay(&start, &end);
+
+   GameConnection* conn = item->getControllingClient();
+   U32 tick = getProcessList()->getTotalTicks();
+   pruneAimRays(tick);
+
+   for (U32 i = 0; i < mAimRays.size(); i++)
+      if (mAimRays[i].conn == conn && mAimRays[i].owner == item &&
+          mAimRays[i].start == start && mAimRays[i].end == end)
+         return;
+
+   AimRay ray;
+   ray.conn = conn;
+   ray.tick = tick;
+   ray.cell = getCellKey(start);
+   ray.start = start;
+   ray.end = end;
+   ray.owner = item;
+   ray.item = item;
+   ray.hit = false;
+   mAimRays.push_back(ray);
+}
+
+S32 QSORT_CALLBACK StateItemManager::_compareAimRay(const void* a, const void* b)
+{
+   U64 cellA = ((const AimRay*)a)->cell;
+   U64 cellB = ((const AimRay*)b)->cell;
+   return (cellA < cellB) ? -1 : ((cellA > cellB) ? 1 : 0);
+}
+
+void StateItemManager::traceSubmittedAimRays()
+{
+   U32 count = mAimRays.size() - mFirstUntraced;
+   if (!count)
+      return;
+
+   PROFILE_SCOPE(StateItemManager_TraceAimRays);
+
+   // Neighbouring rays walk the same bins one after another.
+   if (count > 1)
+      dQsort(mAimRays.address() + mFirstUntraced, count, sizeof(AimRay), _compareAimRay);
+
+   for (U32 i = mFirstUntraced; i < mAimRays.size(); i++)
+      if (mAimRays[i].item)
+         castAimRay(mAimRays[i]);
+   mFirstUntraced = mAimRays.size();
+}
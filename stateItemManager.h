@@ -0,0 +1,395 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMMANAGER_H_
+#define _STATEITEMMANAGER_H_
+
+#ifndef _TVECTOR_H_
+   #include "core/util/tVector.h"
+#endif
+#ifndef _TDICTIONARY_H_
+   #include "core/util/tDictionary.h"
+#endif
+#ifndef _SIM_H_
+   #include "console/sim.h"
+#endif
+#ifndef _PLATFORM_THREAD_SEMAPHORE_H_
+   #include "platform/threads/semaphore.h"
+#endif
+#ifndef _SCENECONTAINER_H_
+   #include "scene/sceneContainer.h"
+#endif
+#ifndef _THREADSAFEDEQUE_H_
+   #include "platform/threads/threadSafeDeque.h"
+#endif
+
+class StateItem;
+class GameConnection;
+class ProcessList;
+class SceneManager;
+class SceneRenderState;
+struct StateItemData;
+struct StateItemCollisionScratch;
+
+//----------------------------------------------------------------------------
+
+/// Advances the state machines of every StateItem in one pass per tick.
+///
+/// There is one manager for the server process list and one for the client.
+/// Items are grouped into a Batch per datablock, and the fields the state
+/// machine touches every tick are kept in structure-of-arrays form inside
+/// the batch rather than in the StateItem itself.  The StateItem accessors
+/// are views into that storage, so the tick loop only has to walk a handful
+/// of flat arrays and only calls into the item when a transition fires.
+///
+/// Each tick runs in two phases.  Phase one advances the timers and picks
+/// the transition for every item; it only writes the item's own slot, so
+/// large item counts are split into chunks and evaluated on the global
+/// thread pool.  Phase two applies the recorded transitions through
+/// StateItem::setState on the main thread in object id order.  Both the
+/// serial and the threaded path go through the same two phases, so the
+/// result doesn't depend on the thread count.
+///
+/// This changes gameplay from the original StateItem, whose state machine
+/// never advanced on its own.  Only the trigger and flag setters called
+/// updateState(0), so delayTime never ran down.  A timeout transition only
+/// fired once the timer was already out and an input changed.  Now timeouts
+/// run down every tick on both the server and the client, so a state with a
+/// timeout transition leaves when its timeout expires.  A datablock that
+/// used such a state to hold until the next trigger has to drop the timeout
+/// transition.
+///
+/// Items that can't change state until something pokes them are put to
+/// sleep: they are moved past Batch::activeCount, where the tick loop
+/// doesn't look, and on the server are taken off the process list.  See
+/// StateItem::canSleep() and StateItem::wakeUp().
+///
+/// Before the state machines, the manager runs the physics stage for all
+/// moving items.  Items whose working collision set needs rebuilding are
+/// bucketed by the spatial hash cell of their query box, and each cell
+/// does a single container query whose results are shared by every item
+/// in it.  The box sweeps then run on the thread pool like phase one, each
+/// thread with its own StateItemCollisionScratch, while the contact ray
+/// casts and the collision callbacks stay on the main thread.
+///
+/// Corrected aim traces (see StateItem::getCorrectedAim) are cached per
+/// controlling client and item for the process list tick they were made in,
+/// so every muzzle vector query an item makes from the same camera in a
+/// tick shares one ray cast.  The item is part of the key since the cast
+/// leaves it out; a second item of the same client, dual wielded say, must
+/// not reuse a trace that could have hit it.
+/// Before phase two applies the transitions, the items entering a fire state
+/// submit their aim rays, which are traced together sorted by cell; the fire
+/// callbacks then find their rays already traced.
+///
+/// StateItem trigger and flag setters called off the main thread, by
+/// network, AI or other worker threads, don't touch the batch; they queue an
+/// InputCommand on the lock free mInputQueue instead, and the manager runs
+/// the queued setters on the main thread before its next tick.
+class StateItemManager
+{
+   friend class StateItemEvalWorkItem;
+   friend class StateItemSweepWorkItem;
+   friend class StateItemRecorder;
+
+public:
+
+   /// All the StateItems sharing one datablock.
+   struct Batch
+   {
+      StateItemData* dataBlock;
+
+      /// @name Per-item storage
+      /// Indexed by StateItem::mBatchSlot.
+      /// @{
+      Vector<StateItem*> items;     ///< NULL for slots freed mid-tick.
+      Vector<F32> delayTime;        ///< Time till next state.
+      Vector<F32> remainingDt;      ///< Remaining delta time for state transitions.
+      Vector<S32> stateIndex;       ///< Index into dataBlock->state, -1 if none.
+      Vector<U32> inputs;           ///< StateItemData::TransitionInputs bits.
+      Vector<U32> fireCount;        ///< Fire skip count, see StateItem::fireCount().
+      Vector<S32> nextState;        ///< Transition picked by phase one, -1 if none.
+      /// @}
+
+      /// Slots [0, activeCount) are ticked, the rest are asleep.
+      U32 activeCount;
+
+      bool dirty;                   ///< Slots were freed mid-tick and need compacting.
+
+      Batch(StateItemData* db);
+
+      U32 size() const { return items.size(); }
+
+      /// Adds an awake item with default state and returns its slot.
+      U32 add(StateItem* item);
+
+      /// Frees a slot, keeping the awake items in front.
+      void remove(U32 slot);
+
+      /// Copies slot from over slot to.
+      void copySlot(U32 from, U32 to);
+      void swapSlots(U32 a, U32 b);
+
+      /// Drops the slots freed while the batch was being ticked.
+      void compact();
+   };
+
+   StateItemManager(bool isServer);
+   ~StateItemManager();
+
+   /// Returns the server or client manager.
+   static StateItemManager* get(bool server) { return server ? smServer : smClient; }
+
+   static void init();
+   static void shutdown();
+
+   /// Item count at which phase one is spread over the thread pool.
+   static S32 smParallelThreshold;
+
+   /// Items per phase one work chunk.
+   static S32 smChunkSize;
+
+   /// Edge length of a broadphase cell, in meters.
+   static F32 smBroadphaseCellSize;
+
+   /// Puts the item into the batch for its current datablock.  If the
+   /// item was in another batch its inputs and fire count carry over.
+   void addItem(StateItem* item);
+   void removeItem(StateItem* item);
+
+   /// Re-enters the current state of every item on dataBlock, once its
+   /// states have arrived from the server.  See StateItemDataCache.
+   void resetStates(StateItemData* dataBlock);
+
+   /// Moves the item out of the ticked range of its batch.
+   void sleepItem(StateItem* item);
+
+   /// Moves a sleeping item back into the ticked range.  During a tick
+   /// this is put off until the tick is over.
+   void wakeItem(StateItem* item);
+
+   /// Casts the aim ray from start to end for item, unless it already cast
+   /// the same ray for its controlling client this tick.  Returns true on a
+   /// hit.
+   bool traceAimRay(StateItem* item, const Point3F& start, const Point3F& end, Point3F* hitPoint);
+
+   /// Queues the item's aim ray for the next traceSubmittedAimRays.
+   void submitAimRay(StateItem* item);
+
+   /// Casts the queued aim rays, sorted by cell.
+   void traceSubmittedAimRays();
+
+   /// Spatial hash key of the cell pos falls in.
+   static U64 getCellKey(const Point3F& pos);
+
+   /// The StateItem setters that can be queued from other threads.
+   enum InputCommandType
+   {
+      TriggerCommand,
+      AltTriggerCommand,
+      AmmoCommand,
+      WetCommand,
+      MotionCommand,
+      TargetCommand,
+      LoadedCommand,
+      GenericTriggerCommand,
+   };
+
+   /// A setter call waiting for the main thread.  By id, the item may be
+   /// deleted before it runs.
+   struct InputCommand
+   {
+      SimObjectId id;
+      U8 type;                   ///< InputCommandType.
+      U8 trigger;                ///< Generic trigger index.
+      bool value;
+   };
+
+   /// Queues a setter call for the next tick; safe from any thread.
+   void queueInput(const InputCommand& command) { mInputQueue.pushBack(command); }
+
+   /// Client side, tracks a mounted item for the mount pass.
+   void addMounted(StateItem* item);
+   void removeMounted(StateItem* item);
+
+   /// Called by mounted items as they advance, so the next render places
+   /// them.  dt is the frame's advanceTime delta.
+   void markMountsStale(F32 dt) { mMountsStale = true; mMountDt = dt; }
+
+protected:
+
+   static StateItemManager* smServer;
+   static StateItemManager* smClient;
+
+   bool mIsServer;
+   bool mTicking;
+   SimTime mTimeAccum;
+
+   typedef HashTable<StateItemData*, Batch*> BatchMap;
+   BatchMap mBatchMap;
+   Vector<Batch*> mBatches;
+
+   /// A run of slots in one batch, evaluated as a unit in phase one.
+   struct EvalChunk
+   {
+      Batch* batch;
+      U32 start;
+      U32 end;
+   };
+   Vector<EvalChunk> mChunks;
+   volatile U32 mNextChunk;      ///< Next unclaimed entry in mChunks.
+   Semaphore mWorkDone;          ///< Released once by each helper that started.
+
+   /// The helper sequence in the high 24 bits, and how many helpers of
+   /// that sequence started in the low 8.  The pool is shared, so a helper
+   /// may only get to run after the main thread did all the work itself.
+   volatile U32 mHelperState;
+
+   /// A transition recorded in phase one, applied in phase two.
+   struct PendingTransition
+   {
+      SimObjectId id;
+      StateItem* item;
+      Batch* batch;
+      U32 slot;
+      S32 fromState;
+      S32 toState;
+   };
+   Vector<PendingTransition> mPending;
+
+   /// Items woken while slots couldn't be moved.
+   Vector<StateItem*> mPendingWake;
+
+   /// Setters called off the main thread, many producers, drained by
+   /// drainInputs() on the main thread.
+   ThreadSafeDeque<InputCommand> mInputQueue;
+
+   /// Runs the queued setters, in the order they were queued.
+   void drainInputs();
+
+   /// @name Physics stage
+   /// @{
+
+   /// A moving item, by slot so it can be checked for deletion by script.
+   struct MovingItem
+   {
+      Batch* batch;
+      U32 slot;
+   };
+   Vector<MovingItem> mMoving;
+
+   /// A moving item that needs a new working list, keyed by cell.
+   struct BroadphaseQuery
+   {
+      U64 cell;
+      U32 moving;                ///< Index into mMoving.
+   };
+   Vector<BroadphaseQuery> mQueries;
+
+   SimpleQueryList mCandidates;
+
+   /// Scratch per physics thread, the main thread uses the first.
+   Vector<StateItemCollisionScratch*> mScratch;
+   /// @}
+
+   /// @name Aim rays
+   /// @{
+
+   /// An aim trace, good for the rest of the tick it was made in.
+   struct AimRay
+   {
+      GameConnection* conn;
+      U32 tick;                  ///< ProcessList::getTotalTicks() when submitted.
+      U64 cell;
+      Point3F start;
+      Point3F end;
+      StateItem* owner;          ///< Left out of the cast, part of the key.
+      StateItem* item;           ///< The owner until traced, then NULL.
+      bool hit;
+      Point3F point;
+   };
+   Vector<AimRay> mAimRays;      ///< This tick's rays, untraced ones last.
+   U32 mFirstUntraced;
+
+   ProcessList* getProcessList() const;
+
+   /// Drops the rays from earlier ticks.
+   void pruneAimRays(U32 tick);
+
+   void castAimRay(AimRay& ray);
+   static S32 QSORT_CALLBACK _compareAimRay(const void* a, const void* b);
+   /// @}
+
+   /// @name Mount pass
+   ///
+   /// Client side, mounted items take their render transforms from their
+   /// mounts once a frame, just before the scene is rendered, when every
+   /// object has advanced.  mMounted is kept sorted by mount depth, so a
+   /// StateItem mounted on a StateItem is placed after its parent and each
+   /// item is placed once, from an up to date parent.
+   /// @{
+   Vector<StateItem*> mMounted;
+   bool mMountOrderDirty;
+   bool mMountsStale;            ///< Objects advanced since the last pass.
+   bool mVoicesStale;            ///< Same, for StateItemVoicePool::updateVoices.
+   F32 mMountDt;
+
+   /// Number of StateItems between item and the root of its mount chain.
+   static U32 getMountDepth(StateItem* item);
+   void sortMounted();
+
+   /// Hooked to the scene pre render signal on the client.
+   void _onPreRender(SceneManager* sceneManager, const SceneRenderState* state);
+   /// @}
+
+   Batch* findOrCreateBatch(StateItemData* db);
+
+   /// Hooked to the process list post tick signal.
+   void _onPostTick(SimTime elapsedMs);
+
+   void tick(F32 dt);
+
+   /// Integrates and collides every moving item.
+   void updatePhysics(F32 dt);
+
+   /// Rebuilds the working lists for mQueries, one container query per cell.
+   void updateBroadphase();
+
+   /// Claims chunks of mMoving and sweeps them until there are none left.
+   void sweepMoving(F32 dt, StateItemCollisionScratch& scratch);
+
+   /// Number of pool helpers worth queueing for the given work.
+   U32 getHelperCount(U32 itemCount, U32 chunkCount);
+
+   /// The sequence helpers queued now belong to.
+   U32 getHelperSequence() const { return mHelperState >> 8; }
+
+   /// Called by a helper before it touches anything.  False if the main
+   /// thread has moved past the sequence it was queued in, and the helper
+   /// must return without doing anything.
+   bool startHelper(U32 sequence);
+
+   /// Stops any more helpers of the current sequence starting, and waits
+   /// for the ones that did.
+   void finishHelpers();
+   static S32 QSORT_CALLBACK _compareQuery(const void* a, const void* b);
+
+   /// Claims and evaluates chunks until there are none left.  Called
+   /// from the main thread and from the pool work items.
+   void evaluateChunks(F32 dt);
+   static void evaluateChunk(const EvalChunk& chunk, F32 dt);
+
+   /// Applies the phase one transitions, in object id order.
+   void applyTransitions();
+   static S32 QSORT_CALLBACK _comparePending(const void* a, const void* b);
+
+   /// Energy and remainder time datablocks need the full item update.
+   static bool needsItemUpdate(const Batch& batch);
+
+   /// Puts idle items to sleep and wakes the ones poked during the tick.
+   void updateSleeping();
+};
+
+#endif // _STATEITEMMANAGER_H_
@@ -0,0 +1,599 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemRecorder.h"
+
+#include "T3D/StateItem.h"
+#include "T3D/stateItemManager.h"
+#include "T3D/gameBase/processList.h"
+#include "console/console.h"
+#include "console/engineAPI.h"
+#include "math/mathIO.h"
+#include "platform/platformTimer.h"
+
+
+StateItemRecorder* StateItemRecorder::smRecorder = NULL;
+
+// Log file header, "SIR1".
+static const U32 sLogFileTag = 0x31524953;
+
+// How far a replayed item may end up from where the recording left it.
+static const F32 sPositionToleranceSq = 0.001f * 0.001f;
+
+//----------------------------------------------------------------------------
+
+StateItemRecorder::StateItemRecorder()
+{
+   mItemCount = 0;
+   mTick = 0;
+   mWrittenTick = 0;
+}
+
+void StateItemRecorder::writeTransform(Stream& stream, const MatrixF& mat)
+{
+   mathWrite(stream, mat.getPosition());
+   mathWrite(stream, QuatF(mat));
+}
+
+void StateItemRecorder::readTransform(Stream& stream, MatrixF* mat)
+{
+   Point3F pos;
+   QuatF rot;
+   mathRead(stream, &pos);
+   mathRead(stream, &rot);
+   rot.setMatrix(mat);
+   mat->setPosition(pos);
+}
+
+//----------------------------------------------------------------------------
+
+static S32 QSORT_CALLBACK compareItemId(const void* a, const void* b)
+{
+   return S32((*(StateItem**)a)->getId()) - S32((*(StateItem**)b)->getId());
+}
+
+bool StateItemRecorder::start(const char* fileName)
+{
+   StateItemManager* manager = StateItemManager::get(true);
+   if (!manager)
+   {
+      Con::errorf("StateItemRecorder: no server to record");
+      return false;
+   }
+   if (smRecorder)
+      stop();
+
+   // In id order, so the replayed items are created, and so transition,
+   // in the same order.
+   Vector<StateItem*> items;
+   for (U32 i = 0; i < manager->mBatches.size(); i++)
+   {
+      StateItemManager::Batch* batch = manager->mBatches[i];
+      for (U32 j = 0; j < batch->size(); j++)
+         if (batch->items[j])
+            items.push_back(batch->items[j]);
+   }
+   dQsort(items.address(), items.size(), sizeof(StateItem*), compareItemId);
+
+   if (items.size() > MaxItems)
+   {
+      Con::warnf("StateItemRecorder: only the first %d of %d items are recorded", S32(MaxItems), items.size());
+      items.setSize(MaxItems);
+   }
+
+   StateItemRecorder* recorder = new StateItemRecorder;
+   Platform::createPath(fileName);
+   if (!recorder->mStream.open(fileName, Torque::FS::File::Write))
+   {
+      Con::errorf("StateItemRecorder: unable to write %s", fileName);
+      delete recorder;
+      return false;
+   }
+
+   for (U32 i = 0; i < items.size(); i++)
+      recorder->mItemIndex.insertUnique(items[i]->getId(), i);
+   recorder->mItemCount = items.size();
+
+   Stream& stream = recorder->mStream;
+   stream.write(sLogFileTag);
+   stream.write(U32(items.size()));
+   for (U32 i = 0; i < items.size(); i++)
+   {
+      StateItem* item = items[i];
+      stream.writeString(item->mDataBlock->getName() ? item->mDataBlock->getName() : avar("%d", item->mDataBlock->getId()));
+      writeTransform(stream, item->getTransform());
+      mathWrite(stream, item->getVelocity());
+      stream.write(U8((item->mStatic ? 1 : 0) | (item->mRotate ? 2 : 0)));
+      stream.write(item->getStateIndex());
+      stream.write(item->delayTime());
+      stream.write(item->mBatch->inputs[item->mBatchSlot]);
+      stream.write(item->fireCount());
+
+      if (item->isMounted())
+      {
+         stream.write(recorder->getMountIndex(item->getObjectMount()));
+         stream.write(item->mMount.node);
+         writeTransform(stream, item->mMount.xfm);
+      }
+      else
+         stream.write(S32(NotMounted));
+   }
+
+   smRecorder = recorder;
+   Con::printf("StateItemRecorder: recording %d items to %s", items.size(), fileName);
+   return true;
+}
+
+void StateItemRecorder::stop()
+{
+   if (!smRecorder)
+      return;
+
+   StateItemRecorder* recorder = smRecorder;
+   smRecorder = NULL;
+
+   recorder->writeTick();
+   Stream& stream = recorder->mStream;
+   stream.write(U8(EndEvent));
+
+   // Where every item ended up, by log index.
+   Vector<StateItem*> items;
+   items.setSize(recorder->mItemCount);
+   dMemset(items.address(), 0, items.memSize());
+   StateItemManager* manager = StateItemManager::get(true);
+   for (U32 i = 0; manager && i < manager->mBatches.size(); i++)
+   {
+      StateItemManager::Batch* batch = manager->mBatches[i];
+      for (U32 j = 0; j < batch->size(); j++)
+      {
+         StateItem* item = batch->items[j];
+         if (!item)
+            continue;
+         HashTable<SimObjectId, U32>::Iterator itr = recorder->mItemIndex.find(item->getId());
+         if (itr != recorder->mItemIndex.end())
+            items[itr->value] = item;
+      }
+   }
+
+   for (U32 i = 0; i < items.size(); i++)
+   {
+      stream.write(U8(items[i] != NULL));
+      if (items[i])
+      {
+         stream.write(items[i]->getStateIndex());
+         mathWrite(stream, items[i]->getPosition());
+      }
+   }
+
+   Con::printf("StateItemRecorder: recorded %d ticks", recorder->mTick);
+   delete recorder;
+}
+
+//----------------------------------------------------------------------------
+
+S32 StateItemRecorder::getEventItem(StateItem* item)
+{
+   // The events the state machine raises itself replay by themselves.
+   StateItemManager* manager = StateItemManager::get(true);
+   if (!item->isServerObject() || !manager || manager->mTicking)
+      return -1;
+
+   HashTable<SimObjectId, U32>::Iterator itr = mItemIndex.find(item->getId());
+   return (itr == mItemIndex.end()) ? -1 : S32(itr->value);
+}
+
+S32 StateItemRecorder::getMountIndex(SceneObject* mount)
+{
+   if (!mount)
+      return NotMounted;
+
+   HashTable<SimObjectId, U32>::Iterator itr = mItemIndex.find(mount->getId());
+   if (itr == mItemIndex.end() || !dynamic_cast<StateItem*>(mount))
+      return UntrackedMount;
+   return itr->value;
+}
+
+void StateItemRecorder::writeTick()
+{
+   if (mTick == mWrittenTick)
+      return;
+
+   mStream.write(U8(TickEvent));
+   mStream.write(mTick - mWrittenTick);
+   mWrittenTick = mTick;
+}
+
+void StateItemRecorder::writeInput(StateItem* item, U32 bit, bool set)
+{
+   S32 index = getEventItem(item);
+   if (index < 0)
+      return;
+
+   AssertFatal(isPow2(bit), "StateItemRecorder::writeInput - one input at a time");
+   writeTick();
+   mStream.write(U8(InputEvent));
+   mStream.write(U16(index));
+   mStream.write(U8(getBinLog2(bit) | (set ? 0x80 : 0)));
+}
+
+void StateItemRecorder::writeImpulse(StateItem* item, const VectorF& vel)
+{
+   S32 index = getEventItem(item);
+   if (index < 0)
+      return;
+
+   writeTick();
+   mStream.write(U8(ImpulseEvent));
+   mStream.write(U16(index));
+   mathWrite(mStream, vel);
+}
+
+void StateItemRecorder::writeMount(StateItem* item, SceneObject* mount)
+{
+   S32 index = getEventItem(item);
+   if (index < 0)
+      return;
+
+   writeTick();
+   mStream.write(U8(MountEvent));
+   mStream.write(U16(index));
+   mStream.write(getMountIndex(mount));
+   if (mount)
+   {
+      mStream.write(item->mMount.node);
+      writeTransform(mStream, item->mMount.xfm);
+   }
+}
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+enum ReplayPhase
+{
+   InputPhase,
+   PhysicsPhase,
+   StatePhase,
+   SleepPhase,
+   NumReplayPhases
+};
+
+/// An item mounted on another when the recording started.
+struct InitialMount
+{
+   U32 item;
+   S32 mount;
+   S32 node;
+   MatrixF xfm;
+};
+
+/// Splits one running timer between the replay phases.
+struct PhaseTimer
+{
+   PlatformTimer* timer;
+   S32 last;
+   S32 ms[NumReplayPhases];
+
+   PhaseTimer()
+   {
+      timer = PlatformTimer::create();
+      last = timer->getElapsedMs();
+      dMemset(ms, 0, sizeof(ms));
+   }
+   ~PhaseTimer() { delete timer; }
+
+   /// Charges the time since the last mark to phase.
+   void mark(ReplayPhase phase)
+   {
+      S32 now = timer->getElapsedMs();
+      ms[phase] += now - last;
+      last = now;
+   }
+};
+
+}
+
+static StateItem* getReplayItem(const Vector<SimObjectPtr<StateItem> >& items, U32 index)
+{
+   return (index < items.size()) ? (StateItem*)items[index] : NULL;
+}
+
+bool StateItemRecorder::replay(const char* fileName)
+{
+   StateItemManager* manager = StateItemManager::get(true);
+   if (!manager)
+   {
+      Con::errorf("StateItemRecorder: no server to replay %s in", fileName);
+      return false;
+   }
+   if (smRecorder)
+   {
+      Con::errorf("StateItemRecorder: can't replay while recording");
+      return false;
+   }
+
+   FileStream stream;
+   if (!stream.open(fileName, Torque::FS::File::Read))
+   {
+      Con::errorf("StateItemRecorder: unable to open %s", fileName);
+      return false;
+   }
+
+   U32 tag, count;
+   if (!stream.read(&tag) || tag != sLogFileTag || !stream.read(&count))
+   {
+      Con::errorf("StateItemRecorder: %s is not a StateItem recording", fileName);
+      return false;
+   }
+
+   // Rebuild the items, then their mounts, which may be on later items.
+   Vector<InitialMount> mounts;
+   Vector<SimObjectPtr<StateItem> > items;
+   Vector<bool> placed;          ///< False if mounted on something we don't have.
+   items.setSize(count);
+   placed.setSize(count);
+
+   for (U32 i = 0; i < count; i++)
+   {
+      char dataBlockName[256];
+      MatrixF mat;
+      VectorF vel;
+      U8 flags;
+      S32 stateIndex;
+      F32 delay;
+      U32 inputs, fireCount;
+      S32 mount;
+
+      stream.readString(dataBlockName);
+      readTransform(stream, &mat);
+      mathRead(stream, &vel);
+      stream.read(&flags);
+      stream.read(&stateIndex);
+      stream.read(&delay);
+      stream.read(&inputs);
+      stream.read(&fireCount);
+      stream.read(&mount);
+
+      placed[i] = (mount != UntrackedMount);
+      if (mount >= 0)
+      {
+         InitialMount im;
+         im.item = i;
+         im.mount = mount;
+         stream.read(&im.node);
+         readTransform(stream, &im.xfm);
+         mounts.push_back(im);
+      }
+      else if (mount == UntrackedMount)
+      {
+         S32 node;
+         MatrixF xfm;
+         stream.read(&node);
+         readTransform(stream, &xfm);
+      }
+
+      StateItemData* dataBlock;
+      if (!Sim::findObject(dataBlockName, dataBlock))
+      {
+         Con::errorf("StateItemRecorder: no StateItemData %s", dataBlockName);
+         continue;
+      }
+
+      StateItem* item = new StateItem;
+      item->mStatic = flags & 1;
+      item->mRotate = flags & 2;
+      item->setDataBlock(dataBlock);
+      item->setTransform(mat);
+      if (!item->registerObject())
+      {
+         delete item;
+         continue;
+      }
+      items[i] = item;
+
+      item->setVelocity(vel);
+      if (stateIndex >= 0)
+         item->setState(stateIndex, true);
+      item->delayTime() = delay;
+      item->fireCount() = fireCount;
+      item->mBatch->inputs[item->mBatchSlot] = inputs;
+   }
+
+   for (U32 i = 0; i < mounts.size(); i++)
+   {
+      StateItem* item = getReplayItem(items, mounts[i].item);
+      StateItem* mount = getReplayItem(items, mounts[i].mount);
+      if (item && mount)
+         mount->mountObject(item, mounts[i].node, mounts[i].xfm);
+   }
+
+   // Run the events, stepping the manager on each tick event the way
+   // StateItemManager::_onPostTick does.
+   PhaseTimer timer;
+   U32 ticks = 0;
+   bool ended = false;
+   bool corrupt = false;
+   while (!ended && !corrupt)
+   {
+      U8 type;
+      if (!stream.read(&type))
+         break;
+
+      switch (type)
+      {
+         case TickEvent:
+         {
+            U32 n;
+            stream.read(&n);
+            timer.mark(InputPhase);
+            for (U32 i = 0; i < n; i++)
+            {
+               manager->mTicking = true;
+               manager->updatePhysics(TickSec);
+               timer.mark(PhysicsPhase);
+               manager->tick(TickSec);
+               timer.mark(StatePhase);
+               manager->mTicking = false;
+
+               for (U32 j = 0; j < manager->mBatches.size(); j++)
+                  if (manager->mBatches[j]->dirty)
+                     manager->mBatches[j]->compact();
+               manager->updateSleeping();
+               timer.mark(SleepPhase);
+            }
+            ticks += n;
+            break;
+         }
+
+         case InputEvent:
+         {
+            U16 index;
+            U8 input;
+            stream.read(&index);
+            stream.read(&input);
+            StateItem* item = getReplayItem(items, index);
+            if (!item)
+               break;
+
+            // As the trigger setters do.
+            U32 bit = 1 << (input & 0x7F);
+            item->setInput(bit, input & 0x80);
+            if (bit & (StateItemData::TriggerInput | StateItemData::AltTriggerInput))
+               item->updateState(0);
+            break;
+         }
+
+         case ImpulseEvent:
+         {
+            U16 index;
+            VectorF vel;
+            stream.read(&index);
+            mathRead(stream, &vel);
+            StateItem* item = getReplayItem(items, index);
+            if (item)
+               item->setVelocity(vel);
+            break;
+         }
+
+         case MountEvent:
+         {
+            U16 index;
+            S32 mountIndex;
+            S32 node = -1;
+            MatrixF xfm(true);
+            stream.read(&index);
+            stream.read(&mountIndex);
+            if (mountIndex != NotMounted)
+            {
+               stream.read(&node);
+               readTransform(stream, &xfm);
+            }
+
+            StateItem* item = getReplayItem(items, index);
+            if (!item)
+               break;
+
+            if (item->isMounted())
+               item->unmount();
+            StateItem* mount = (mountIndex >= 0) ? getReplayItem(items, mountIndex) : NULL;
+            if (mount)
+               mount->mountObject(item, node, xfm);
+            if (mountIndex == UntrackedMount)
+               placed[index] = false;
+            break;
+         }
+
+         case EndEvent:
+            ended = true;
+            break;
+
+         default:
+            corrupt = true;
+            break;
+      }
+   }
+   timer.mark(InputPhase);
+
+   U32 mismatches = 0;
+   if (!ended)
+      Con::errorf("StateItemRecorder: %s is %s, not checking the result", fileName, corrupt ? "corrupt" : "truncated");
+   else
+   {
+      for (U32 i = 0; i < count; i++)
+      {
+         U8 alive;
+         S32 stateIndex = -1;
+         Point3F pos(0.0f, 0.0f, 0.0f);
+         stream.read(&alive);
+         if (alive)
+         {
+            stream.read(&stateIndex);
+            mathRead(stream, &pos);
+         }
+
+         StateItem* item = getReplayItem(items, i);
+         if (bool(alive) != (item != NULL))
+         {
+            Con::warnf("StateItemRecorder: item %d %s", i, alive ? "was lost" : "outlived the recording");
+            mismatches++;
+         }
+         else if (item && item->getStateIndex() != stateIndex)
+         {
+            Con::warnf("StateItemRecorder: item %d ended in state %d, not %d", i, item->getStateIndex(), stateIndex);
+            mismatches++;
+         }
+         else if (item && placed[i] && (item->getPosition() - pos).lenSquared() > sPositionToleranceSq)
+         {
+            Point3F at = item->getPosition();
+            Con::warnf("StateItemRecorder: item %d ended at %g %g %g, not %g %g %g", i, at.x, at.y, at.z, pos.x, pos.y, pos.z);
+            mismatches++;
+         }
+      }
+   }
+
+   S32 total = 0;
+   for (U32 i = 0; i < NumReplayPhases; i++)
+      total += timer.ms[i];
+   Con::printf("StateItemRecorder: replayed %d ticks of %d items from %s", ticks, count, fileName);
+   Con::printf("   inputs %d ms, physics %d ms, states %d ms, sleep %d ms, %.3f ms a tick",
+      timer.ms[InputPhase], timer.ms[PhysicsPhase], timer.ms[StatePhase], timer.ms[SleepPhase],
+      ticks ? F32(total) / F32(ticks) : 0.0f);
+   Con::printf("   %d mismatches", mismatches);
+
+   for (U32 i = 0; i < items.size(); i++)
+      if (items[i])
+         items[i]->deleteObject();
+
+   return ended && mismatches == 0;
+}
+
+//----------------------------------------------------------------------------
+
+DefineEngineFunction( startStateItemRecording, bool, ( const char* fileName ),,
+   "@brief Records what drives the server StateItems to a file, for replayStateItemRecording().\n\n"
+   "@param fileName The log to write.\n"
+   "@return True if recording started.\n"
+   "@ingroup GameObjects" )
+{
+   return StateItemRecorder::start(fileName);
+}
+
+DefineEngineFunction( stopStateItemRecording, void, (),,
+   "@brief Finishes the StateItem recording started by startStateItemRecording().\n\n"
+   "@ingroup GameObjects" )
+{
+   StateItemRecorder::stop();
+}
+
+DefineEngineFunction( replayStateItemRecording, bool, ( const char* fileName ),,
+   "@brief Replays a StateItem recording as fast as it can and prints the time taken by each phase.\n\n"
+   "Replay into the mission the recording was made in, with the recorded items gone.\n\n"
+   "@param fileName The log to replay.\n"
+   "@return True if every item ended in the state and position it was recorded in.\n"
+   "@ingroup GameObjects" )
+{
+   return StateItemRecorder::replay(fileName);
+}
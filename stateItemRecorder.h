@@ -0,0 +1,127 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMRECORDER_H_
+#define _STATEITEMRECORDER_H_
+
+#ifndef _FILESTREAM_H_
+   #include "core/stream/fileStream.h"
+#endif
+#ifndef _TDICTIONARY_H_
+   #include "core/util/tDictionary.h"
+#endif
+#ifndef _MMATRIX_H_
+   #include "math/mMatrix.h"
+#endif
+
+class StateItem;
+class SceneObject;
+
+//----------------------------------------------------------------------------
+
+/// Records what drives the server StateItems, and plays it back as a
+/// benchmark.
+///
+/// start() writes every server StateItem as it is then: datablock,
+/// transform, velocity, state, timers, inputs and mount.  From then on the
+/// log gets, per StateItemManager tick, the input bits set through
+/// StateItem::setInput (which every trigger and flag setter ends in), the
+/// impulses and the mounts and unmounts.  Only what comes from outside the
+/// manager tick is written; what the state scripts do in the tick comes
+/// out the same on replay.  stop() writes the ticks run and the final state
+/// and position of every recorded item.
+///
+/// replay() rebuilds the items in the running server, steps the server
+/// manager through the recorded ticks as fast as it can, applying the
+/// events in between, and prints the time spent applying inputs, moving
+/// items, running the state machines and sleeping idle items.  The final
+/// states and positions are checked against the log.  Replay into the
+/// mission the log was made in, without the recorded items in it; items
+/// mounted on something that isn't a recorded StateItem can't be placed
+/// and have their positions left out of the check.
+class StateItemRecorder
+{
+public:
+
+   static bool start(const char* fileName);
+   static void stop();
+   static bool isRecording() { return smRecorder != NULL; }
+
+   /// Plays a log back, returns true if it ended where the recording did.
+   static bool replay(const char* fileName);
+
+   /// @name Hooks
+   /// Called from the server StateItem; cheap when not recording.
+   /// @{
+   static void recordInput(StateItem* item, U32 bit, bool set)
+   {
+      if (smRecorder)
+         smRecorder->writeInput(item, bit, set);
+   }
+   static void recordImpulse(StateItem* item, const VectorF& vel)
+   {
+      if (smRecorder)
+         smRecorder->writeImpulse(item, vel);
+   }
+   /// mount is NULL for an unmount.
+   static void recordMount(StateItem* item, SceneObject* mount)
+   {
+      if (smRecorder)
+         smRecorder->writeMount(item, mount);
+   }
+
+   /// Called by the server StateItemManager before each tick.
+   static void onTick()
+   {
+      if (smRecorder)
+         smRecorder->mTick++;
+   }
+   /// @}
+
+protected:
+
+   static StateItemRecorder* smRecorder;
+
+   enum EventType
+   {
+      TickEvent,                 ///< U32 ticks run.
+      InputEvent,                ///< U16 item, U8 bit index | set << 7.
+      ImpulseEvent,              ///< U16 item, velocity.
+      MountEvent,                ///< U16 item, S32 mount item, node and offset.
+      EndEvent,                  ///< Followed by the final item records.
+   };
+
+   /// Mount item indices that aren't a recorded item.
+   enum
+   {
+      NotMounted = -1,
+      UntrackedMount = -2,
+      MaxItems = 0xFFFF,
+   };
+
+   FileStream mStream;
+   HashTable<SimObjectId, U32> mItemIndex;
+   U32 mItemCount;
+   U32 mTick;                 ///< Manager ticks run since start().
+   U32 mWrittenTick;          ///< Tick of the last TickEvent.
+
+   StateItemRecorder();
+
+   /// Index of item in the log, -1 if it isn't in it or the event comes
+   /// from inside the tick.
+   S32 getEventItem(StateItem* item);
+   void writeTick();
+
+   void writeInput(StateItem* item, U32 bit, bool set);
+   void writeImpulse(StateItem* item, const VectorF& vel);
+   void writeMount(StateItem* item, SceneObject* mount);
+
+   S32 getMountIndex(SceneObject* mount);
+
+   static void writeTransform(Stream& stream, const MatrixF& mat);
+   static void readTransform(Stream& stream, MatrixF* mat);
+};
+
+#endif // _STATEITEMRECORDER_H_
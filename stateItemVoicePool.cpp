@@ -0,0 +1,233 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "T3D/stateItemVoicePool.h"
+
+#include "T3D/StateItem.h"
+#include "T3D/gameBase/gameProcess.h"
+#include "core/module.h"
+#include "platform/profiler.h"
+#include "sfx/sfxSystem.h"
+#include "sfx/sfxSource.h"
+#include "sfx/sfxTrack.h"
+#include "sfx/sfxDescription.h"
+
+
+StateItemVoicePool* StateItemVoicePool::smPool = NULL;
+
+S32 StateItemVoicePool::smMaxVoices = 32;
+S32 StateItemVoicePool::smMaxFreeSources = 32;
+
+MODULE_BEGIN( StateItemVoicePool )
+
+   MODULE_INIT_AFTER( ProcessList )
+   MODULE_SHUTDOWN_BEFORE( ProcessList )
+
+   MODULE_INIT
+   {
+      StateItemVoicePool::init();
+   }
+
+   MODULE_SHUTDOWN
+   {
+      StateItemVoicePool::shutdown();
+   }
+
+MODULE_END;
+
+//----------------------------------------------------------------------------
+
+void StateItemVoicePool::init()
+{
+   smPool = new StateItemVoicePool;
+}
+
+void StateItemVoicePool::shutdown()
+{
+   SAFE_DELETE(smPool);
+}
+
+StateItemVoicePool::StateItemVoicePool()
+{
+   ClientProcessList::get()->postTickSignal().notify( this, &StateItemVoicePool::_onPostTick );
+}
+
+StateItemVoicePool::~StateItemVoicePool()
+{
+   ClientProcessList::get()->postTickSignal().remove( this, &StateItemVoicePool::_onPostTick );
+
+   // The sources may already be gone with the sound system, the
+   // SimObjectPtrs will be NULL then.
+   for (U32 i = 0; i < mVoices.size(); i++)
+      if (mVoices[i].source)
+         SFX_DELETE(mVoices[i].source);
+   for (U32 i = 0; i < mFree.size(); i++)
+      if (mFree[i].source)
+         SFX_DELETE(mFree[i].source);
+}
+
+//----------------------------------------------------------------------------
+
+F32 StateItemVoicePool::getAudibility(SFXTrack* track, const Point3F& pos)
+{
+   SFXDescription* desc = track->getDescription();
+   if (!desc)
+      return 0.0f;
+
+   F32 audibility = desc->mPriority;
+   if (desc->mIs3D && SFX)
+   {
+      F32 dist = (pos - SFX->getListener().getTransform().getPosition()).len();
+      if (dist > desc->mMinDistance)
+      {
+         F32 range = desc->mMaxDistance - desc->mMinDistance;
+         F32 falloff = (range > 0.0f) ? (dist - desc->mMinDistance) / range : 1.0f;
+         audibility *= 1.0f - mClampF(falloff, 0.0f, 1.0f);
+      }
+   }
+   return audibility;
+}
+
+SFXSource* StateItemVoicePool::acquireSource(SFXTrack* track, const MatrixF& transform, const VectorF& velocity)
+{
+   // Newest first, it is the least likely to be deleted soon.
+   for (S32 i = mFree.size() - 1; i >= 0; i--)
+   {
+      if (mFree[i].track != track)
+         continue;
+
+      SFXSource* source = mFree[i].source;
+      mFree.erase(i);
+      if (!source)
+         continue;
+
+      source->setTransform(transform);
+      source->setVelocity(velocity);
+      return source;
+   }
+
+   return SFX->createSource(track, &transform, &velocity);
+}
+
+void StateItemVoicePool::releaseVoice(U32 index)
+{
+   Voice voice = mVoices[index];
+   mVoices.erase(index);
+
+   if (!voice.source)
+      return;
+
+   voice.source->stop();
+   voice.owner = NULL;
+   mFree.push_back(voice);
+
+   while (mFree.size() > (U32)getMax(smMaxFreeSources, 0))
+   {
+      if (mFree.first().source)
+         SFX_DELETE(mFree.first().source);
+      mFree.pop_front();
+   }
+}
+
+bool StateItemVoicePool::play(StateItem* owner, SFXTrack* track, const MatrixF& transform, const VectorF& velocity, S32 maxPerOwner)
+{
+   if (!SFX || !track)
+      return false;
+
+   PROFILE_SCOPE(StateItemVoicePool_Play);
+
+   // Per item cap, the oldest goes.
+   if (maxPerOwner > 0)
+   {
+      S32 count = 0;
+      S32 oldest = -1;
+      for (U32 i = 0; i < mVoices.size(); i++)
+         if (mVoices[i].owner == owner)
+         {
+            if (oldest == -1)
+               oldest = i;
+            count++;
+         }
+      if (count >= maxPerOwner)
+         releaseVoice(oldest);
+   }
+
+   // Global cap, the quietest goes unless the new sound is quieter still.
+   // Ties go to the new sound, the last shot fired is the one to hear.
+   if (mVoices.size() >= (U32)getMax(smMaxVoices, 1))
+   {
+      S32 quietest = -1;
+      F32 quietestAudibility = 0.0f;
+      for (U32 i = 0; i < mVoices.size(); i++)
+      {
+         const Voice& voice = mVoices[i];
+         Point3F pos = voice.source ? voice.source->getTransform().getPosition() : Point3F::Zero;
+         F32 audibility = voice.source ? getAudibility(voice.track, pos) : -1.0f;
+         if (quietest == -1 || audibility < quietestAudibility)
+         {
+            quietest = i;
+            quietestAudibility = audibility;
+         }
+      }
+
+      if (getAudibility(track, transform.getPosition()) < quietestAudibility)
+         return false;
+
+      releaseVoice(quietest);
+   }
+
+   SFXSource* source = acquireSource(track, transform, velocity);
+   if (!source)
+      return false;
+
+   source->play();
+
+   Voice voice;
+   voice.source = source;
+   voice.track = track;
+   voice.owner = owner;
+   mVoices.push_back(voice);
+   return true;
+}
+
+void StateItemVoicePool::stopOwner(StateItem* owner)
+{
+   for (S32 i = mVoices.size() - 1; i >= 0; i--)
+      if (mVoices[i].owner == owner)
+         releaseVoice(i);
+}
+
+void StateItemVoicePool::updateVoices()
+{
+   PROFILE_SCOPE(StateItemVoicePool_UpdateVoices);
+
+   // Owners stop their voices when they go, so every owner here is live.
+   for (U32 i = 0; i < mVoices.size(); i++)
+   {
+      Voice& voice = mVoices[i];
+      if (!voice.source)
+         continue;
+
+      voice.source->setTransform(voice.owner->getRenderTransform());
+      voice.source->setVelocity(voice.owner->getVelocity());
+   }
+}
+
+void StateItemVoicePool::_onPostTick(SimTime elapsedMs)
+{
+   if (mVoices.empty())
+      return;
+
+   PROFILE_SCOPE(StateItemVoicePool_Update);
+
+   // Recycle what finished, the owners move the rest.
+   for (S32 i = mVoices.size() - 1; i >= 0; i--)
+   {
+      Voice& voice = mVoices[i];
+      if (!voice.source || voice.source->isStopped())
+         releaseVoice(i);
+   }
+}
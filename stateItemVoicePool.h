@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+// Torque 3D
+// Copyright (C) GarageGames.com, Inc.
+//-----------------------------------------------------------------------------
+
+#ifndef _STATEITEMVOICEPOOL_H_
+#define _STATEITEMVOICEPOOL_H_
+
+#ifndef _TVECTOR_H_
+   #include "core/util/tVector.h"
+#endif
+#ifndef _SIM_H_
+   #include "console/sim.h"
+#endif
+#ifndef _SIMOBJECTPTR_H_
+   #include "console/simObjectPtr.h"
+#endif
+#ifndef _MPOINT3_H_
+   #include "math/mPoint3.h"
+#endif
+
+class StateItem;
+class SFXTrack;
+class SFXSource;
+class MatrixF;
+
+//----------------------------------------------------------------------------
+
+/// Plays the state sounds of every client StateItem out of one set of voices.
+///
+/// Sources are never deleted when a sound ends.  They go on a free list
+/// keyed by track and are restarted the next time that track plays, so a
+/// weapon firing over and over reuses the same few sources.
+///
+/// The number of sounds playing at once is capped by smMaxVoices.  When the
+/// cap is reached, the quietest voice is stopped to make room, where quiet
+/// means the description's priority scaled down by distance to the
+/// listener.  If the new sound is quieter than every voice playing, it
+/// doesn't start.
+///
+/// Voice transforms follow their owner's render transform, moved in one
+/// pass a frame by updateVoices().  Finished voices are recycled in one
+/// pass after the client process list advances.
+class StateItemVoicePool
+{
+public:
+
+   StateItemVoicePool();
+   ~StateItemVoicePool();
+
+   static StateItemVoicePool* get() { return smPool; }
+
+   static void init();
+   static void shutdown();
+
+   /// Most sounds StateItems may play at once.
+   static S32 smMaxVoices;
+
+   /// Most stopped sources kept for reuse.
+   static S32 smMaxFreeSources;
+
+   /// Starts track at the owner.  If the owner already has maxPerOwner
+   /// voices its oldest is stopped first, 0 means no limit.  Returns false
+   /// if the sound lost out to the voices already playing.
+   bool play(StateItem* owner, SFXTrack* track, const MatrixF& transform, const VectorF& velocity, S32 maxPerOwner);
+
+   /// Stops every voice the owner is playing.
+   void stopOwner(StateItem* owner);
+
+   /// Moves every voice to its owner's render transform.  Called once a
+   /// frame by the client StateItemManager, after mounted items are placed.
+   void updateVoices();
+
+   U32 getVoiceCount() const { return mVoices.size(); }
+
+protected:
+
+   static StateItemVoicePool* smPool;
+
+   struct Voice
+   {
+      SimObjectPtr<SFXSource> source;
+      SFXTrack* track;
+      StateItem* owner;
+   };
+
+   /// Playing voices, oldest first.
+   Vector<Voice> mVoices;
+
+   /// Stopped sources, oldest first.
+   Vector<Voice> mFree;
+
+   /// Hooked to the client process list post tick signal.
+   void _onPostTick(SimTime elapsedMs);
+
+   /// How audible a sound at pos would be, higher is more.
+   static F32 getAudibility(SFXTrack* track, const Point3F& pos);
+
+   /// Returns a stopped source for track, or creates one.
+   SFXSource* acquireSource(SFXTrack* track, const MatrixF& transform, const VectorF& velocity);
+
+   /// Stops voice index and moves its source to the free list.
+   void releaseVoice(U32 index);
+};
+
+#endif // _STATEITEMVOICEPOOL_H_